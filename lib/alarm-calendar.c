@@ -103,6 +103,7 @@ calendar_play(nsv_notification *n)
                  "repeat", FALSE,
                  "min-timeout", 3000,
                  "max-timeout", 10000,
+                 "latency", nsv_notification_get_latency(n),
                  "event-id", "alarm-clock-elapsed",
                  NULL);
     g_signal_connect(G_OBJECT(priv->playback), "error",
@@ -168,7 +169,8 @@ static struct notification_impl calendar =
   "Alarm calendar",
   "Alarm",
   10,
-  1
+  1,
+  NSV_PLAYBACK_LATENCY_NORMAL
 };
 
 void
@@ -204,6 +204,7 @@ clock_play(nsv_notification *n)
                  "volume", 50,
                  "repeat", TRUE,
                  "min-timeout", 3000,
+                 "latency", nsv_notification_get_latency(n),
                  "event-id", "alarm-clock-elapsed",
                  NULL);
 
@@ -233,7 +234,8 @@ static struct notification_impl alarm_clock =
   "Alarm clock",
   "Alarm",
   10,
-  1
+  1,
+  NSV_PLAYBACK_LATENCY_POWER_SAVING
 }; // weak
 
 void register_alarm_clock()
@@ -118,6 +118,7 @@ event_play(nsv_notification *n)
                "volume", n->volume,
                "repeat", FALSE,
                "min-timeout", 3000,
+               "latency", nsv_notification_get_latency(n),
                "event-id", "message-new-email", NULL);
 
   g_signal_connect(G_OBJECT(priv->playback), "error",
@@ -174,7 +175,8 @@ static struct notification_impl message_events =
   "Message event",
   "Event",
   5,
-  4
+  4,
+  NSV_PLAYBACK_LATENCY_NORMAL
 };
 
 void
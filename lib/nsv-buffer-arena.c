@@ -0,0 +1,105 @@
+#include <glib.h>
+
+#include "nsv-buffer-arena.h"
+
+/* size classes are powers of two from 4 KiB up to 256 KiB */
+#define NSV_BUFFER_ARENA_MIN_SHIFT 12
+#define NSV_BUFFER_ARENA_CLASSES 7
+#define NSV_BUFFER_ARENA_MAX_FREE 4
+
+struct nsv_buffer_arena
+{
+  GSList *free[NSV_BUFFER_ARENA_CLASSES];
+  guint free_count[NSV_BUFFER_ARENA_CLASSES];
+  gsize in_use;
+  gsize high_water_mark;
+};
+
+static struct nsv_buffer_arena arena;
+
+static guint
+_nsv_buffer_arena_class(gsize size)
+{
+  guint shift = NSV_BUFFER_ARENA_MIN_SHIFT;
+
+  while (shift < NSV_BUFFER_ARENA_MIN_SHIFT + NSV_BUFFER_ARENA_CLASSES &&
+         ((gsize)1 << shift) < size)
+  {
+    shift++;
+  }
+
+  return shift - NSV_BUFFER_ARENA_MIN_SHIFT;
+}
+
+gpointer
+nsv_buffer_arena_alloc(gsize size, gsize *allocated)
+{
+  guint cls = _nsv_buffer_arena_class(size);
+  gpointer buffer;
+
+  /* anything bigger than the largest class is capped to it */
+  if (cls >= NSV_BUFFER_ARENA_CLASSES)
+    cls = NSV_BUFFER_ARENA_CLASSES - 1;
+
+  *allocated = (gsize)1 << (cls + NSV_BUFFER_ARENA_MIN_SHIFT);
+
+  if (arena.free[cls])
+  {
+    buffer = arena.free[cls]->data;
+    arena.free[cls] = g_slist_delete_link(arena.free[cls], arena.free[cls]);
+    arena.free_count[cls]--;
+  }
+  else
+    buffer = g_malloc(*allocated);
+
+  arena.in_use += *allocated;
+
+  if (arena.in_use > arena.high_water_mark)
+  {
+    arena.high_water_mark = arena.in_use;
+    g_debug("Buffer arena high water mark is now %" G_GSIZE_FORMAT " bytes",
+            arena.high_water_mark);
+  }
+
+  return buffer;
+}
+
+void
+nsv_buffer_arena_free(gpointer buffer, gsize allocated)
+{
+  guint cls;
+
+  if (!buffer)
+    return;
+
+  cls = _nsv_buffer_arena_class(allocated);
+  arena.in_use -= allocated;
+
+  if (cls < NSV_BUFFER_ARENA_CLASSES &&
+      arena.free_count[cls] < NSV_BUFFER_ARENA_MAX_FREE)
+  {
+    arena.free[cls] = g_slist_prepend(arena.free[cls], buffer);
+    arena.free_count[cls]++;
+  }
+  else
+    g_free(buffer);
+}
+
+void
+nsv_buffer_arena_trim()
+{
+  guint cls;
+
+  for (cls = 0; cls < NSV_BUFFER_ARENA_CLASSES; cls++)
+  {
+    g_slist_free_full(arena.free[cls], g_free);
+    arena.free[cls] = NULL;
+    arena.free_count[cls] = 0;
+  }
+}
+
+gsize
+nsv_buffer_arena_get_high_water_mark()
+{
+  return arena.high_water_mark;
+}
@@ -0,0 +1,12 @@
+#ifndef NSV_BUFFER_ARENA_H
+#define NSV_BUFFER_ARENA_H
+
+#include <glib.h>
+
+gpointer nsv_buffer_arena_alloc(gsize size, gsize *allocated);
+void nsv_buffer_arena_free(gpointer buffer, gsize allocated);
+void nsv_buffer_arena_trim();
+
+gsize nsv_buffer_arena_get_high_water_mark();
+
+#endif // NSV_BUFFER_ARENA_H
@@ -1,9 +1,38 @@
 #include <dbus/dbus-glib-bindings.h>
 #include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <pulse/pulseaudio.h>
 
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <stdio.h>
+#include <errno.h>
+#include <string.h>
 
 #include "nsv-decoder.h"
+#include "nsv-decoder-task.h"
+#include "nsv-notification.h"
+#include "nsv-pulse-context.h"
+#include "nsv-util.h"
+
+#define NSV_DECODER_TYPE_OPTIONS (dbus_g_type_get_map("GHashTable", \
+            G_TYPE_STRING, G_TYPE_VALUE))
+#define NSV_DECODER_TYPE_REQUEST (dbus_g_type_get_struct("GValueArray", \
+            G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, \
+            NSV_DECODER_TYPE_OPTIONS, G_TYPE_INVALID))
+#define NSV_DECODER_TYPE_REQUESTS (dbus_g_type_get_collection("GPtrArray", \
+            NSV_DECODER_TYPE_REQUEST))
+#define NSV_DECODER_TYPE_RESULT (dbus_g_type_get_struct("GValueArray", \
+            G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INVALID))
+#define NSV_DECODER_TYPE_RESULTS (dbus_g_type_get_collection("GPtrArray", \
+            NSV_DECODER_TYPE_RESULT))
+
+/* canonical RIFF/WAVE header as written by wavenc */
+#define NSV_DECODER_WAV_HEADER_SIZE 44
+
+/* decoded spec when the sink's is not known, PA upmixes mono for free */
+#define NSV_DECODER_DEFAULT_RATE 48000
+#define NSV_DECODER_CHANNELS 1
 
 #define NSV_DECODER_TYPE (nsv_decoder_get_type ())
 #define NSV_DECODER(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
@@ -15,7 +44,9 @@ typedef struct _NsvDecoderPrivate NsvDecoderPrivate;
 enum
 {
   PROP_0,
-  PROP_TARGET_PATH
+  PROP_TARGET_PATH,
+  PROP_IN_PROCESS,
+  PROP_FORMAT
 };
 
 struct _NsvDecoder
@@ -33,6 +64,70 @@ struct _NsvDecoderPrivate
   gchar *target_path;
   DBusGConnection *conn;
   DBusGProxy *proxy;
+  GHashTable *index;
+  gboolean index_loaded;
+  gboolean index_dirty;
+  GPtrArray *batch;
+  gboolean batch_ended;
+  GThreadPool *hasher;
+  guint hashing;
+  GHashTable *pending;
+  gboolean in_process;
+  gchar *format;
+  struct nsv_decoder_worker *worker;
+};
+
+/* runs NsvDecoderTask on a thread of its own, instead of the service */
+struct nsv_decoder_worker
+{
+  NsvDecoder *decoder;
+  GThread *thread;
+  GMainContext *context;
+  GMainLoop *loop;
+  GAsyncQueue *results;
+
+  /* worker thread only */
+  GQueue queue;
+  NsvDecoderTask *task;
+  NsvDecoderPipeline *pipeline;
+  /* task -> every category that asked for it */
+  GHashTable *categories;
+};
+
+struct nsv_decoder_worker_result
+{
+  gchar *category;
+  gchar *source_file;
+  gchar *target_file;
+  gboolean succeeded;
+};
+
+struct nsv_decoder_worker_call
+{
+  struct nsv_decoder_worker *worker;
+  NsvDecoderTask *task;
+  gchar *source_file;
+  gboolean supersede;
+};
+
+/* what a source file looked like when its content was hashed */
+struct nsv_decoder_index_entry
+{
+  gchar *digest;
+  gint64 mtime;
+  gint64 size;
+};
+
+/* a source whose content is hashed off the main thread */
+struct nsv_decoder_hash_job
+{
+  NsvDecoder *decoder;
+  gchar *category;
+  gchar *source_file;
+  gboolean supersede;
+  gchar *digest;
+  gint64 mtime;
+  gint64 size;
 };
 
 G_DEFINE_TYPE(NsvDecoder, nsv_decoder, G_TYPE_OBJECT);
@@ -45,53 +140,763 @@ struct nsv_decoder_decode_data
 
 static GObjectClass *parent_class = NULL;
 
-static gchar *
-_nsv_decoder_create_target_filename(NsvDecoder *self, const gchar *target_file)
+/* decoded formats, in order of preference */
+static const gchar *formats[] = {"alaw", "mulaw", NULL};
+
+/* names from before the index, after the basename of the source */
+static const gchar *legacy_extensions[] = {"wav", "decoded"};
+
+static const gchar *
+_nsv_decoder_get_target_path(NsvDecoder *self)
+{
+  return self->priv->target_path ? self->priv->target_path : ".";
+}
+
+static void
+_nsv_decoder_index_entry_free(gpointer data)
+{
+  struct nsv_decoder_index_entry *entry =
+      (struct nsv_decoder_index_entry *)data;
+
+  g_free(entry->digest);
+  g_slice_free(struct nsv_decoder_index_entry, entry);
+}
+
+static void
+_nsv_decoder_load_index(NsvDecoder *self)
 {
   NsvDecoderPrivate *priv = self->priv;
+  gchar *filename;
+  gchar *contents;
+  gchar **lines;
+  int i;
+
+  if (priv->index_loaded)
+    return;
+
+  priv->index_loaded = TRUE;
+  filename = g_build_filename(_nsv_decoder_get_target_path(self), "index",
+                              NULL);
+
+  if (!g_file_get_contents(filename, &contents, NULL, NULL))
+  {
+    g_free(filename);
+    return;
+  }
+
+  /* digest, mtime, size and the source path, tab separated */
+  lines = g_strsplit(contents, "\n", -1);
+
+  for (i = 0; lines[i]; i++)
+  {
+    gchar **fields = g_strsplit(lines[i], "\t", 4);
+
+    if (g_strv_length(fields) == 4)
+    {
+      struct nsv_decoder_index_entry *entry =
+          g_slice_new(struct nsv_decoder_index_entry);
+
+      entry->digest = g_strdup(fields[0]);
+      entry->mtime = g_ascii_strtoll(fields[1], NULL, 10);
+      entry->size = g_ascii_strtoll(fields[2], NULL, 10);
+      g_hash_table_replace(priv->index, g_strdup(fields[3]), entry);
+    }
+
+    g_strfreev(fields);
+  }
+
+  g_strfreev(lines);
+  g_free(contents);
+  g_free(filename);
+}
+
+static void
+_nsv_decoder_save_index(NsvDecoder *self)
+{
+  GString *contents = g_string_new(NULL);
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  gchar *filename;
+
+  g_hash_table_iter_init(&iter, self->priv->index);
+
+  while (g_hash_table_iter_next(&iter, &key, &value))
+  {
+    struct nsv_decoder_index_entry *entry =
+        (struct nsv_decoder_index_entry *)value;
+
+    g_string_append_printf(contents,
+                           "%s\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT
+                           "\t%s\n", entry->digest, entry->mtime,
+                           entry->size, (const gchar *)key);
+  }
+
+  filename = g_build_filename(_nsv_decoder_get_target_path(self), "index",
+                              NULL);
+
+  if (!g_file_set_contents(filename, contents->str, contents->len, NULL))
+    g_warning("Unable to write decoder index '%s'", filename);
+
+  g_free(filename);
+  g_string_free(contents, TRUE);
+}
+
+static void
+_nsv_decoder_flush_index(NsvDecoder *self)
+{
+  if (self->priv->index_dirty)
+  {
+    self->priv->index_dirty = FALSE;
+    _nsv_decoder_save_index(self);
+  }
+}
+
+/* a batch writes the index once, when it is sent */
+static void
+_nsv_decoder_index_changed(NsvDecoder *self)
+{
+  self->priv->index_dirty = TRUE;
+
+  if (!self->priv->batch)
+    _nsv_decoder_flush_index(self);
+}
+
+/* only what the index knows, new content is left to _nsv_decoder_hash */
+static const gchar *
+_nsv_decoder_get_digest(NsvDecoder *self, const gchar *source_file)
+{
+  NsvDecoderPrivate *priv = self->priv;
+  struct nsv_decoder_index_entry *entry;
+  struct stat st;
+
+  if (!source_file)
+    return NULL;
+
+  _nsv_decoder_load_index(self);
+  entry = (struct nsv_decoder_index_entry *)g_hash_table_lookup(priv->index,
+                                                                source_file);
+
+  /* the source may be on an unmounted card, trust what we saw last time */
+  if (stat(source_file, &st) == -1)
+    return entry ? entry->digest : NULL;
+
+  if (entry && entry->mtime == st.st_mtime && entry->size == st.st_size)
+    return entry->digest;
+
+  return NULL;
+}
+
+static gchar *
+_nsv_decoder_create_legacy_filename(NsvDecoder *self, const gchar *source_file,
+                                    const gchar *extension)
+{
+  gchar *basename = g_path_get_basename(source_file);
+  gchar *rv = g_strdup_printf("%s/%s.%s", _nsv_decoder_get_target_path(self),
+                              basename, extension);
+
+  g_free(basename);
+
+  return rv;
+}
+
+static void
+_nsv_decoder_remove_legacy(NsvDecoder *self, const gchar *source_file)
+{
+  gchar *decoded;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(legacy_extensions); i++)
+  {
+    decoded = _nsv_decoder_create_legacy_filename(self, source_file,
+                                                  legacy_extensions[i]);
+    g_unlink(decoded);
+    g_free(decoded);
+  }
+}
+
+static const gchar *
+_nsv_decoder_get_extension(const gchar *format)
+{
+  /* still wav files, the format tag says how the samples are stored */
+  if (!g_strcmp0(format, "alaw"))
+    return "alaw.wav";
+
+  if (!g_strcmp0(format, "mulaw"))
+    return "mulaw.wav";
+
+  return "wav";
+}
+
+static gint
+_nsv_decoder_get_rate()
+{
+  pa_sample_spec spec;
+
+  /* resample once here rather than on every play */
+  if (nsv_pulse_context_get_sink_spec(nsv_pulse_context_get_instance(),
+                                      &spec))
+  {
+    return spec.rate;
+  }
+
+  return NSV_DECODER_DEFAULT_RATE;
+}
+
+/* the spec is part of the name, a new sink rate means a new decode */
+static gchar *
+_nsv_decoder_create_filename(NsvDecoder *self, const gchar *digest,
+                             const gchar *format)
+{
+  return g_strdup_printf("%s/%s-%d-%d.%s", _nsv_decoder_get_target_path(self),
+                         digest, _nsv_decoder_get_rate(), NSV_DECODER_CHANNELS,
+                         _nsv_decoder_get_extension(format));
+}
+
+static gchar *
+_nsv_decoder_create_target_filename(NsvDecoder *self, const gchar *source_file)
+{
+  const gchar *digest = _nsv_decoder_get_digest(self, source_file);
+
+  if (digest)
+    return _nsv_decoder_create_filename(self, digest, self->priv->format);
+
+  return NULL;
+}
+
+static void
+_nsv_decoder_finish_part(NsvDecoder *self, const char *source_file,
+                         const char *target_file)
+{
+  gchar *target_filename;
+
+  /* only a complete file gets its final name */
+  if (!g_str_has_suffix(target_file, ".part"))
+    return;
+
+  target_filename =
+      g_strndup(target_file, strlen(target_file) - strlen(".part"));
+
+  /* every category that asked for the file gets a result, one renames it */
+  if (rename(target_file, target_filename) && errno != ENOENT)
+  {
+    g_warning("Can't rename decoded file '%s'", target_file);
+    g_unlink(target_file);
+  }
+  else if (source_file)
+  {
+    /* the decoded file from before the index is superseded now */
+    _nsv_decoder_remove_legacy(self, source_file);
+  }
+
+  g_free(target_filename);
+}
+
+static void
+_nsv_decoder_decoded_cb(DBusGProxy *proxy, gchar *category, gchar *source_file,
+                        char *target_file, gpointer user_data)
+{
+  NsvDecoder *self = NSV_DECODER(user_data);
+
+  g_hash_table_remove(self->priv->pending, source_file);
+  _nsv_decoder_finish_part(self, source_file, target_file);
+}
+
+static void
+_nsv_decoder_error_decoding_cb(DBusGProxy *proxy, gchar *category,
+                               gchar *source_file, char *target_file,
+                               gpointer user_data)
+{
+  NsvDecoder *self = NSV_DECODER(user_data);
+
+  g_hash_table_remove(self->priv->pending, source_file);
+
+  if (g_str_has_suffix(target_file, ".part"))
+    g_unlink(target_file);
+}
+
+static void
+_nsv_decoder_result_get(gpointer result, gchar **source_file,
+                        gchar **target_file)
+{
+  GValue value = {0, };
+
+  g_value_init(&value, NSV_DECODER_TYPE_RESULT);
+  g_value_set_static_boxed(&value, result);
+  dbus_g_type_struct_get(&value,
+                         1, source_file,
+                         2, target_file,
+                         G_MAXUINT);
+  g_value_unset(&value);
+}
+
+static void
+_nsv_decoder_batch_decoded_cb(DBusGProxy *proxy, guint batch,
+                              GPtrArray *decoded, GPtrArray *failed,
+                              gpointer user_data)
+{
+  NsvDecoder *self = NSV_DECODER(user_data);
+  gchar *source_file;
+  gchar *target_file;
+  guint i;
+
+  g_debug("Batch %u finished, %u decoded, %u failed", batch, decoded->len,
+          failed->len);
+
+  for (i = 0; i < decoded->len; i++)
+  {
+    source_file = target_file = NULL;
+    _nsv_decoder_result_get(g_ptr_array_index(decoded, i), &source_file,
+                            &target_file);
+
+    if (source_file)
+      g_hash_table_remove(self->priv->pending, source_file);
+
+    if (target_file)
+      _nsv_decoder_finish_part(self, source_file, target_file);
+
+    g_free(source_file);
+    g_free(target_file);
+  }
+
+  for (i = 0; i < failed->len; i++)
+  {
+    source_file = target_file = NULL;
+    _nsv_decoder_result_get(g_ptr_array_index(failed, i), &source_file,
+                            &target_file);
+
+    if (source_file)
+      g_hash_table_remove(self->priv->pending, source_file);
+
+    if (target_file && g_str_has_suffix(target_file, ".part"))
+      g_unlink(target_file);
+
+    g_free(source_file);
+    g_free(target_file);
+  }
+}
+
+static void
+_nsv_decoder_worker_result_free(struct nsv_decoder_worker_result *result)
+{
+  g_free(result->category);
+  g_free(result->source_file);
+  g_free(result->target_file);
+  g_slice_free(struct nsv_decoder_worker_result, result);
+}
+
+static gboolean
+_nsv_decoder_worker_result_cb(gpointer user_data)
+{
+  struct nsv_decoder_worker *worker = (struct nsv_decoder_worker *)user_data;
+  struct nsv_decoder_worker_result *result =
+      (struct nsv_decoder_worker_result *)g_async_queue_try_pop(
+        worker->results);
+
+  if (!result)
+    return FALSE;
+
+  /* same thing the service signals would do */
+  if (result->succeeded)
+  {
+    _nsv_decoder_decoded_cb(NULL, result->category, result->source_file,
+                            result->target_file, worker->decoder);
+  }
+  else
+  {
+    _nsv_decoder_error_decoding_cb(NULL, result->category, result->source_file,
+                                   result->target_file, worker->decoder);
+  }
+
+  _nsv_decoder_worker_result_free(result);
+
+  return FALSE;
+}
+
+static gint
+_nsv_decoder_worker_compare_priority(gconstpointer a, gconstpointer b,
+                                     gpointer user_data)
+{
+  return ((const NsvDecoderTask *)a)->priority >=
+      ((const NsvDecoderTask *)b)->priority ? -1 : 1;
+}
+
+static void _nsv_decoder_worker_start_next(struct nsv_decoder_worker *worker);
+
+static void
+_nsv_decoder_worker_push_result(struct nsv_decoder_worker *worker,
+                                NsvDecoderTask *task, gboolean succeeded)
+{
+  GSList *categories =
+      (GSList *)g_hash_table_lookup(worker->categories, task);
+  GSList *l;
+
+  g_hash_table_remove(worker->categories, task);
+
+  /* everybody who asked for this file gets the result */
+  for (l = categories; l; l = l->next)
+  {
+    struct nsv_decoder_worker_result *result =
+        g_slice_new(struct nsv_decoder_worker_result);
+
+    g_object_get(task,
+                 "source-file", &result->source_file,
+                 "target-file", &result->target_file,
+                 NULL);
+    result->category = (gchar *)l->data;
+    result->succeeded = succeeded;
+
+    g_async_queue_push(worker->results, result);
+    g_idle_add(_nsv_decoder_worker_result_cb, worker);
+  }
+
+  g_slist_free(categories);
+}
+
+static void
+_nsv_decoder_worker_task_done(struct nsv_decoder_worker *worker,
+                              gboolean succeeded)
+{
+  NsvDecoderTask *task = worker->task;
+
+  _nsv_decoder_worker_push_result(worker, task, succeeded);
+
+  worker->pipeline = nsv_decoder_task_take_pipeline(task);
+  worker->task = NULL;
+  g_object_unref(task);
+}
+
+static void
+_nsv_decoder_worker_task_succeeded_cb(NsvDecoderTask *task,
+                                      struct nsv_decoder_worker *worker)
+{
+  _nsv_decoder_worker_task_done(worker, TRUE);
+  _nsv_decoder_worker_start_next(worker);
+}
+
+static void
+_nsv_decoder_worker_task_error_cb(NsvDecoderTask *task,
+                                  struct nsv_decoder_worker *worker)
+{
+  nsv_decoder_task_stop(task);
+  _nsv_decoder_worker_task_done(worker, FALSE);
+  _nsv_decoder_worker_start_next(worker);
+}
+
+static void
+_nsv_decoder_worker_start_next(struct nsv_decoder_worker *worker)
+{
+  NsvDecoderTask *task;
+
+  while (!worker->task &&
+         (task = (NsvDecoderTask *)g_queue_pop_head(&worker->queue)))
+  {
+    worker->task = task;
+    g_signal_connect(task, "succeeded",
+                     G_CALLBACK(_nsv_decoder_worker_task_succeeded_cb),
+                     worker);
+    g_signal_connect(task, "error",
+                     G_CALLBACK(_nsv_decoder_worker_task_error_cb), worker);
+
+    if (!worker->pipeline)
+      worker->pipeline = nsv_decoder_pipeline_new();
+
+    if (nsv_decoder_task_start(task, worker->pipeline))
+      worker->pipeline = NULL;
+    else
+      _nsv_decoder_worker_task_done(worker, FALSE);
+  }
+}
+
+static gboolean
+_nsv_decoder_worker_task_has_source(NsvDecoderTask *task,
+                                    const gchar *source_file)
+{
+  gchar *task_source_file = NULL;
+  gboolean matches;
+
+  g_object_get(task, "source-file", &task_source_file, NULL);
+  matches = !g_strcmp0(task_source_file, source_file);
+  g_free(task_source_file);
+
+  return matches;
+}
+
+/* drops source_file, or whatever category wanted other than source_file,
+ * TRUE if nobody wants the task anymore */
+static gboolean
+_nsv_decoder_worker_release_task(struct nsv_decoder_worker *worker,
+                                 NsvDecoderTask *task,
+                                 const gchar *source_file,
+                                 const gchar *category)
+{
+  GSList *categories =
+      (GSList *)g_hash_table_lookup(worker->categories, task);
+  GSList *link;
+
+  if (!category)
+    return _nsv_decoder_worker_task_has_source(task, source_file);
+
+  if (_nsv_decoder_worker_task_has_source(task, source_file) ||
+      !(link = g_slist_find_custom(categories, category,
+                                   (GCompareFunc)g_strcmp0)))
+  {
+    return FALSE;
+  }
+
+  if (!categories->next)
+    return TRUE;
+
+  /* still wanted by somebody else, just stop telling this category */
+  g_free(link->data);
+  g_hash_table_insert(worker->categories, task,
+                      g_slist_delete_link(categories, link));
+
+  return FALSE;
+}
+
+static void
+_nsv_decoder_worker_cancel(struct nsv_decoder_worker *worker,
+                           const gchar *source_file, const gchar *category)
+{
+  GList *l = worker->queue.head;
+
+  while (l)
+  {
+    NsvDecoderTask *task = (NsvDecoderTask *)l->data;
+    GList *next = l->next;
+
+    if (_nsv_decoder_worker_release_task(worker, task, source_file, category))
+    {
+      g_queue_delete_link(&worker->queue, l);
+      _nsv_decoder_worker_push_result(worker, task, FALSE);
+      g_object_unref(task);
+    }
+
+    l = next;
+  }
+
+  if (worker->task &&
+      _nsv_decoder_worker_release_task(worker, worker->task, source_file,
+                                       category))
+  {
+    nsv_decoder_task_stop(worker->task);
+    _nsv_decoder_worker_task_done(worker, FALSE);
+  }
+}
+
+static gboolean
+_nsv_decoder_worker_queue_cb(gpointer user_data)
+{
+  struct nsv_decoder_worker_call *call =
+      (struct nsv_decoder_worker_call *)user_data;
+  struct nsv_decoder_worker *worker = call->worker;
+  const gchar *category = call->task->category;
+  NsvDecoderTask *task = NULL;
+  gchar *source_file = NULL;
+  GSList *categories;
+  GList *l;
+
+  g_object_get(call->task, "source-file", &source_file, NULL);
+
+  /* whatever was decoded for this category before is not going to be heard */
+  if (call->supersede)
+    _nsv_decoder_worker_cancel(worker, source_file, category);
+
+  if (worker->task &&
+      _nsv_decoder_worker_task_has_source(worker->task, source_file))
+  {
+    task = worker->task;
+  }
+
+  for (l = worker->queue.head; !task && l; l = l->next)
+  {
+    if (_nsv_decoder_worker_task_has_source(l->data, source_file))
+      task = (NsvDecoderTask *)l->data;
+  }
+
+  if (task)
+  {
+    /* already queued or running, just wait for its result */
+    categories = (GSList *)g_hash_table_lookup(worker->categories, task);
+
+    if (!g_slist_find_custom(categories, category, (GCompareFunc)g_strcmp0))
+    {
+      g_hash_table_insert(worker->categories, task,
+                          g_slist_append(categories, g_strdup(category)));
+    }
+
+    if (call->task->priority > task->priority &&
+        g_queue_remove(&worker->queue, task))
+    {
+      task->priority = call->task->priority;
+      g_queue_insert_sorted(&worker->queue, task,
+                            _nsv_decoder_worker_compare_priority, NULL);
+    }
+
+    g_object_unref(call->task);
+  }
+  else
+  {
+    g_hash_table_insert(worker->categories, call->task,
+                        g_slist_prepend(NULL, g_strdup(category)));
+    g_queue_insert_sorted(&worker->queue, call->task,
+                          _nsv_decoder_worker_compare_priority, NULL);
+  }
+
+  g_free(source_file);
+  g_slice_free(struct nsv_decoder_worker_call, call);
+  _nsv_decoder_worker_start_next(worker);
+
+  return FALSE;
+}
+
+static gboolean
+_nsv_decoder_worker_promote_cb(gpointer user_data)
+{
+  struct nsv_decoder_worker_call *call =
+      (struct nsv_decoder_worker_call *)user_data;
+  struct nsv_decoder_worker *worker = call->worker;
+  GList *l;
+
+  for (l = worker->queue.head; l; l = l->next)
+  {
+    NsvDecoderTask *task = (NsvDecoderTask *)l->data;
+    gchar *source_file = NULL;
+
+    g_object_get(task, "source-file", &source_file, NULL);
+
+    if (!g_strcmp0(source_file, call->source_file))
+    {
+      g_free(source_file);
+      g_queue_delete_link(&worker->queue, l);
+      task->priority = G_MAXINT;
+      g_queue_push_head(&worker->queue, task);
+      break;
+    }
+
+    g_free(source_file);
+  }
+
+  g_free(call->source_file);
+  g_slice_free(struct nsv_decoder_worker_call, call);
+
+  return FALSE;
+}
+
+static gboolean
+_nsv_decoder_worker_cancel_cb(gpointer user_data)
+{
+  struct nsv_decoder_worker_call *call =
+      (struct nsv_decoder_worker_call *)user_data;
+  struct nsv_decoder_worker *worker = call->worker;
+
+  _nsv_decoder_worker_cancel(worker, call->source_file, NULL);
+  g_free(call->source_file);
+  g_slice_free(struct nsv_decoder_worker_call, call);
+  _nsv_decoder_worker_start_next(worker);
+
+  return FALSE;
+}
+
+static void
+_nsv_decoder_worker_call(struct nsv_decoder_worker *worker,
+                         GSourceFunc func, gpointer data)
+{
+  /* g_main_context_invoke() may run func right here, this never does */
+  GSource *source = g_idle_source_new();
+
+  g_source_set_callback(source, func, data, NULL);
+  g_source_attach(source, worker->context);
+  g_source_unref(source);
+}
+
+static gboolean
+_nsv_decoder_worker_quit_cb(gpointer user_data)
+{
+  struct nsv_decoder_worker *worker = (struct nsv_decoder_worker *)user_data;
+
+  g_main_loop_quit(worker->loop);
+
+  return FALSE;
+}
+
+static gpointer
+_nsv_decoder_worker_thread(gpointer user_data)
+{
+  struct nsv_decoder_worker *worker = (struct nsv_decoder_worker *)user_data;
+  NsvDecoderTask *task;
+
+  /* bus watches and idle sources of the tasks end up here */
+  g_main_context_push_thread_default(worker->context);
+  g_main_loop_run(worker->loop);
+
+  while ((task = (NsvDecoderTask *)g_queue_pop_head(&worker->queue)))
+  {
+    g_slist_free_full(g_hash_table_lookup(worker->categories, task), g_free);
+    g_object_unref(task);
+  }
+
+  if (worker->task)
+  {
+    g_slist_free_full(g_hash_table_lookup(worker->categories, worker->task),
+                      g_free);
+    nsv_decoder_task_stop(worker->task);
+    nsv_decoder_pipeline_free(nsv_decoder_task_take_pipeline(worker->task));
+    g_object_unref(worker->task);
+    worker->task = NULL;
+  }
+
+  nsv_decoder_pipeline_free(worker->pipeline);
+  worker->pipeline = NULL;
+  g_hash_table_destroy(worker->categories);
+
+  g_main_context_pop_thread_default(worker->context);
 
-  if (target_file)
-  {
-    gchar *target_path = priv->target_path;
-    gchar *basename = g_path_get_basename(target_file);
-    gchar *rv;
+  return NULL;
+}
 
-    if (!priv->target_path)
-      target_path = ".";
+static struct nsv_decoder_worker *
+_nsv_decoder_worker_new(NsvDecoder *decoder)
+{
+  struct nsv_decoder_worker *worker = g_slice_new0(struct nsv_decoder_worker);
 
-    rv = g_strdup_printf("%s/%s.%s", target_path, basename, "wav");
-    g_free(basename);
+  gst_init(NULL, NULL);
 
-    return rv;
-  }
+  worker->decoder = decoder;
+  worker->context = g_main_context_new();
+  worker->loop = g_main_loop_new(worker->context, FALSE);
+  worker->results = g_async_queue_new();
+  worker->categories = g_hash_table_new(NULL, NULL);
+  g_queue_init(&worker->queue);
+  worker->thread = g_thread_new("nsv-decoder", _nsv_decoder_worker_thread,
+                                worker);
 
-  return NULL;
+  return worker;
 }
 
 static void
-_nsv_decoder_decoded_cb(DBusGProxy *proxy, gchar *category, gchar *source_file,
-                        char *target_file, gpointer user_data)
+_nsv_decoder_worker_free(struct nsv_decoder_worker *worker)
 {
-  gchar *target_filename =
-      _nsv_decoder_create_target_filename((NsvDecoder *)user_data, source_file);
+  struct nsv_decoder_worker_result *result;
 
-  if (target_filename)
-  {
-    rename(target_file, target_filename);
-    g_free(target_filename);
-  }
-  else
+  _nsv_decoder_worker_call(worker, _nsv_decoder_worker_quit_cb, worker);
+  g_thread_join(worker->thread);
+
+  /* results nobody is going to pick up anymore */
+  while (g_source_remove_by_user_data(worker))
+    ;
+
+  while ((result = (struct nsv_decoder_worker_result *)g_async_queue_try_pop(
+            worker->results)))
   {
-    g_warning("Can't make a decoded filename");
-    g_unlink(target_file);
+    _nsv_decoder_worker_result_free(result);
   }
-}
 
-static void
-_nsv_decoder_error_decoding_cb(DBusGProxy *proxy, gchar *category,
-                               gchar *source_file, char *target_file,
-                               gpointer user_data)
-{
+  g_async_queue_unref(worker->results);
+  g_main_loop_unref(worker->loop);
+  g_main_context_unref(worker->context);
+  g_slice_free(struct nsv_decoder_worker, worker);
 }
 
 static void
@@ -101,6 +906,12 @@ nsv_decoder_init(NsvDecoder *self)
 
   priv = g_new0(NsvDecoderPrivate, 1);
   self->priv = priv;
+  priv->index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                      _nsv_decoder_index_entry_free);
+  priv->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                        NULL);
+  priv->in_process = !g_strcmp0(g_getenv("NSV_DECODER_BACKEND"), "thread");
+  priv->format = g_strdup(g_getenv("NSV_DECODER_FORMAT"));
   priv->conn = dbus_g_bus_get(DBUS_BUS_SESSION, NULL);
 
   priv->proxy = dbus_g_proxy_new_for_name(priv->conn,
@@ -120,12 +931,21 @@ nsv_decoder_init(NsvDecoder *self)
                           G_TYPE_STRING,
                           G_TYPE_STRING,
                           G_TYPE_INVALID);
+  dbus_g_proxy_add_signal(self->priv->proxy,
+                          "BatchDecoded",
+                          G_TYPE_UINT,
+                          NSV_DECODER_TYPE_RESULTS,
+                          NSV_DECODER_TYPE_RESULTS,
+                          G_TYPE_INVALID);
   dbus_g_proxy_connect_signal(
         self->priv->proxy, "Decoded",
         G_CALLBACK(_nsv_decoder_decoded_cb), self, NULL);
   dbus_g_proxy_connect_signal(
         self->priv->proxy, "ErrorDecoding",
         G_CALLBACK(_nsv_decoder_error_decoding_cb), self, NULL);
+  dbus_g_proxy_connect_signal(
+        self->priv->proxy, "BatchDecoded",
+        G_CALLBACK(_nsv_decoder_batch_decoded_cb), self, NULL);
 }
 
 static void
@@ -142,6 +962,17 @@ nsv_decoder_set_property(GObject *object, guint prop_id, const GValue *value,
         g_free(priv->target_path);
 
       priv->target_path = g_value_dup_string(value);
+      priv->index_loaded = FALSE;
+      g_hash_table_remove_all(priv->index);
+      break;
+    case PROP_IN_PROCESS:
+      priv->in_process = g_value_get_boolean(value);
+      break;
+    case PROP_FORMAT:
+      if (priv->format)
+        g_free(priv->format);
+
+      priv->format = g_value_dup_string(value);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -160,6 +991,12 @@ nsv_decoder_get_property(GObject *object, guint prop_id, GValue *value,
     case PROP_TARGET_PATH:
       g_value_set_string(value, priv->target_path);
       break;
+    case PROP_IN_PROCESS:
+      g_value_set_boolean(value, priv->in_process);
+      break;
+    case PROP_FORMAT:
+      g_value_set_string(value, priv->format);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -171,12 +1008,26 @@ nsv_decoder_finalize(GObject *object)
 {
   NsvDecoderPrivate *priv = NSV_DECODER(object)->priv;
 
+  if (priv->worker)
+    _nsv_decoder_worker_free(priv->worker);
+
+  if (priv->hasher)
+    g_thread_pool_free(priv->hasher, FALSE, TRUE);
+
+  if (priv->batch)
+    g_boxed_free(NSV_DECODER_TYPE_REQUESTS, priv->batch);
+
   g_object_unref(priv->proxy);
   dbus_g_connection_unref(priv->conn);
+  g_hash_table_destroy(priv->index);
+  g_hash_table_destroy(priv->pending);
 
   if (priv->target_path)
     g_free(priv->target_path);
 
+  if (priv->format)
+    g_free(priv->format);
+
   g_free(priv);
 
   G_OBJECT_CLASS(parent_class)->finalize(object);
@@ -198,6 +1049,18 @@ nsv_decoder_class_init(NsvDecoderClass *klass)
         g_param_spec_string("target-path",
                             NULL, NULL, NULL,
                             G_PARAM_READWRITE));
+  g_object_class_install_property(
+        object_class, PROP_IN_PROCESS,
+        g_param_spec_boolean("in-process",
+                             NULL, "Decode on a thread instead of the service",
+                             FALSE,
+                             G_PARAM_READWRITE));
+  g_object_class_install_property(
+        object_class, PROP_FORMAT,
+        g_param_spec_string("format",
+                            NULL, "alaw or mulaw, 16 bit PCM otherwise",
+                            NULL,
+                            G_PARAM_READWRITE));
 }
 
 NsvDecoder *
@@ -209,38 +1072,60 @@ nsv_decoder_new()
 gchar *
 nsv_decoder_get_decoded_filename(NsvDecoder *self, const gchar *target_file)
 {
-  gchar *target_filename =
-      _nsv_decoder_create_target_filename(self, target_file);
+  const gchar *digest = _nsv_decoder_get_digest(self, target_file);
+  gchar *target_filename = NULL;
+  guint i;
 
-  if (target_filename && !g_file_test(target_filename, G_FILE_TEST_EXISTS))
+  /* the companded ones are half the size, take them when they are there */
+  for (i = 0; digest && i < G_N_ELEMENTS(formats); i++)
   {
-    NsvDecoderPrivate *priv = self->priv;
+    target_filename = _nsv_decoder_create_filename(self, digest, formats[i]);
+
+    if (g_file_test(target_filename, G_FILE_TEST_EXISTS))
+      break;
 
     g_free(target_filename);
+    target_filename = NULL;
+  }
 
-    if (target_file)
+  for (i = 0; !target_filename && target_file &&
+       i < G_N_ELEMENTS(legacy_extensions); i++)
+  {
+    target_filename = _nsv_decoder_create_legacy_filename(
+          self, target_file, legacy_extensions[i]);
+
+    if (!g_file_test(target_filename, G_FILE_TEST_EXISTS))
     {
-      gchar *basename = g_path_get_basename(target_file);
-      gchar *target_path = priv->target_path;
+      g_free(target_filename);
+      target_filename = NULL;
+    }
+  }
+
+  return target_filename;
+}
 
-      if (!priv->target_path)
-        target_path = ".";
+gchar *
+nsv_decoder_get_partial_filename(NsvDecoder *self, const gchar *source_file)
+{
+  gchar *target_filename =
+      _nsv_decoder_create_target_filename(self, source_file);
+  gchar *partial_filename;
+  struct stat st;
 
-      target_filename =
-          g_strdup_printf("%s/%s.%s", target_path, basename, "decoded");
-      g_free(basename);
+  if (!target_filename)
+    return NULL;
 
-      if (target_filename && !g_file_test(target_filename, G_FILE_TEST_EXISTS))
-      {
-        g_free(target_filename);
-        target_filename = NULL;
-      }
-    }
-    else
-      target_filename = NULL;
+  partial_filename = g_strconcat(target_filename, ".part", NULL);
+  g_free(target_filename);
+
+  /* not worth following until wavenc has written its header */
+  if (g_stat(partial_filename, &st) || st.st_size < NSV_DECODER_WAV_HEADER_SIZE)
+  {
+    g_free(partial_filename);
+    partial_filename = NULL;
   }
 
-  return target_filename;
+  return partial_filename;
 }
 
 static void
@@ -267,36 +1152,493 @@ _nsv_decoder_decode_destroy_notify_cb(gpointer mem_block)
   g_slice_free(struct nsv_decoder_decode_data, mem_block);
 }
 
-void
-nsv_decoder_decode(NsvDecoder *self, const gchar *category,
-                   const gchar *source_file)
+static void
+_nsv_decoder_value_free(gpointer data)
+{
+  GValue *value = (GValue *)data;
+
+  g_value_unset(value);
+  g_slice_free(GValue, value);
+}
+
+static void
+_nsv_decoder_options_set_int(GHashTable *options, const gchar *name,
+                             gint number)
+{
+  GValue *value = g_slice_new0(GValue);
+
+  g_value_init(value, G_TYPE_INT);
+  g_value_set_int(value, number);
+  g_hash_table_insert(options, (gpointer)name, value);
+}
+
+static gint
+_nsv_decoder_options_get_int(GHashTable *options, const gchar *name,
+                             gint default_value)
+{
+  GValue *value = (GValue *)g_hash_table_lookup(options, name);
+
+  if (value && G_VALUE_HOLDS_INT(value))
+    return g_value_get_int(value);
+
+  return default_value;
+}
+
+static void
+_nsv_decoder_options_set_string(GHashTable *options, const gchar *name,
+                                const gchar *s)
+{
+  GValue *value = g_slice_new0(GValue);
+
+  g_value_init(value, G_TYPE_STRING);
+  g_value_set_string(value, s);
+  g_hash_table_insert(options, (gpointer)name, value);
+}
+
+static GHashTable *
+_nsv_decoder_create_options(NsvDecoder *self, const gchar *category)
+{
+  GHashTable *options = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                              _nsv_decoder_value_free);
+
+  /* whatever would interrupt the others gets decoded first too */
+  _nsv_decoder_options_set_int(
+        options, "priority", nsv_notification_get_category_priority(category));
+
+  /* has to match what _nsv_decoder_create_filename puts in the name */
+  _nsv_decoder_options_set_int(options, "rate", _nsv_decoder_get_rate());
+  _nsv_decoder_options_set_int(options, "channels", NSV_DECODER_CHANNELS);
+
+  if (self->priv->format)
+    _nsv_decoder_options_set_string(options, "format", self->priv->format);
+
+  return options;
+}
+
+static void
+_nsv_decoder_options_set_boolean(GHashTable *options, const gchar *name,
+                                 gboolean b)
+{
+  GValue *value = g_slice_new0(GValue);
+
+  g_value_init(value, G_TYPE_BOOLEAN);
+  g_value_set_boolean(value, b);
+  g_hash_table_insert(options, (gpointer)name, value);
+}
+
+static void
+_nsv_decoder_decode_in_process(NsvDecoder *self, const gchar *category,
+                               const gchar *source_file,
+                               const gchar *target_file, GHashTable *options)
 {
   NsvDecoderPrivate *priv = self->priv;
-  gchar *basename;
-  gchar *target_path;
+  struct nsv_decoder_worker_call *call;
+  NsvDecoderTask *task;
+
+  if (!priv->worker)
+    priv->worker = _nsv_decoder_worker_new(self);
+
+  g_hash_table_add(priv->pending, g_strdup(source_file));
+
+  task = nsv_decoder_task_new(source_file, target_file);
+  task->category = g_strdup(category);
+  task->priority = _nsv_decoder_options_get_int(options, "priority", 0);
+  g_object_set(task,
+               "rate", CLAMP(_nsv_decoder_options_get_int(
+                               options, "rate", 48000), 8000, 192000),
+               "channels", CLAMP(_nsv_decoder_options_get_int(
+                                   options, "channels", 1), 1, 2),
+               "format", priv->format,
+               NULL);
+
+  call = g_slice_new0(struct nsv_decoder_worker_call);
+  call->worker = priv->worker;
+  call->task = task;
+  call->supersede = g_hash_table_contains(options, "supersede");
+  _nsv_decoder_worker_call(priv->worker, _nsv_decoder_worker_queue_cb, call);
+}
+
+static void _nsv_decoder_decode(NsvDecoder *self, const gchar *category,
+                                const gchar *source_file, gboolean supersede);
+static void _nsv_decoder_flush_batch(NsvDecoder *self);
+
+static gboolean
+_nsv_decoder_hashed_cb(gpointer user_data)
+{
+  struct nsv_decoder_hash_job *job = (struct nsv_decoder_hash_job *)user_data;
+  NsvDecoder *self = job->decoder;
+  NsvDecoderPrivate *priv = self->priv;
+
+  priv->hashing--;
+
+  if (job->digest)
+  {
+    struct nsv_decoder_index_entry *entry =
+        g_slice_new(struct nsv_decoder_index_entry);
+
+    entry->digest = job->digest;
+    entry->mtime = job->mtime;
+    entry->size = job->size;
+    job->digest = NULL;
+
+    _nsv_decoder_load_index(self);
+    g_hash_table_replace(priv->index, g_strdup(job->source_file), entry);
+    _nsv_decoder_index_changed(self);
+    _nsv_decoder_decode(self, job->category, job->source_file,
+                        job->supersede);
+  }
+
+  /* the batch waited for the last one */
+  if (priv->batch && priv->batch_ended && !priv->hashing)
+    _nsv_decoder_flush_batch(self);
+
+  g_free(job->category);
+  g_free(job->source_file);
+  g_slice_free(struct nsv_decoder_hash_job, job);
+  g_object_unref(self);
+
+  return FALSE;
+}
+
+static void
+_nsv_decoder_hash_thread(gpointer data, gpointer user_data)
+{
+  struct nsv_decoder_hash_job *job = (struct nsv_decoder_hash_job *)data;
+  GMappedFile *mapped;
+  struct stat st;
+
+  /* if it changes meanwhile the index won't match and it is hashed again */
+  if (stat(job->source_file, &st) != -1)
+  {
+    mapped = g_mapped_file_new(job->source_file, FALSE, NULL);
+
+    if (mapped)
+    {
+      job->digest = g_compute_checksum_for_data(
+            G_CHECKSUM_SHA1,
+            (const guchar *)g_mapped_file_get_contents(mapped),
+            g_mapped_file_get_length(mapped));
+      job->mtime = st.st_mtime;
+      job->size = st.st_size;
+      g_mapped_file_unref(mapped);
+    }
+  }
+
+  g_idle_add(_nsv_decoder_hashed_cb, job);
+}
+
+static void
+_nsv_decoder_hash(NsvDecoder *self, const gchar *category,
+                  const gchar *source_file, gboolean supersede)
+{
+  NsvDecoderPrivate *priv = self->priv;
+  struct nsv_decoder_hash_job *job =
+      g_slice_new0(struct nsv_decoder_hash_job);
+
+  /* one at a time, a startup sweep shouldn't compete with the UI */
+  if (!priv->hasher)
+  {
+    priv->hasher = g_thread_pool_new(_nsv_decoder_hash_thread, NULL, 1,
+                                     FALSE, NULL);
+  }
+
+  job->decoder = g_object_ref(self);
+  job->category = g_strdup(category);
+  job->source_file = g_strdup(source_file);
+  job->supersede = supersede;
+  priv->hashing++;
+  g_thread_pool_push(priv->hasher, job, NULL);
+}
+
+static void
+_nsv_decoder_decode(NsvDecoder *self, const gchar *category,
+                    const gchar *source_file, gboolean supersede)
+{
+  const gchar *digest;
+  gchar *target_filename;
   gchar *target_file;
+  GHashTable *options;
   DBusGProxy *proxy;
   struct nsv_decoder_decode_data *data;
 
-  basename = g_path_get_basename(source_file);
-  target_path = priv->target_path;
+  if (!source_file)
+    return;
 
-  if (!priv->target_path)
-    target_path = ".";
+  digest = _nsv_decoder_get_digest(self, source_file);
 
-  target_file = g_strdup_printf("%s/%s.%s", target_path, basename, "wav");
-  g_free(basename);
+  /* new or changed content, this is called again once it is hashed */
+  if (!digest)
+  {
+    _nsv_decoder_hash(self, category, source_file, supersede);
+    return;
+  }
+
+  target_filename = _nsv_decoder_create_filename(self, digest,
+                                                 self->priv->format);
+
+  /* same content was decoded already, maybe for another path */
+  if (nsv_util_valid_sound_file(target_filename))
+  {
+    g_free(target_filename);
+    return;
+  }
+
+  target_file = g_strconcat(target_filename, ".part", NULL);
+  g_free(target_filename);
+  options = _nsv_decoder_create_options(self, category);
+
+  if (supersede)
+    _nsv_decoder_options_set_boolean(options, "supersede", TRUE);
+
+  if (self->priv->in_process)
+  {
+    _nsv_decoder_decode_in_process(self, category, source_file, target_file,
+                                   options);
+    g_hash_table_unref(options);
+    g_free(target_file);
+    return;
+  }
+
+  g_hash_table_add(self->priv->pending, g_strdup(source_file));
+
+  if (self->priv->batch)
+  {
+    GValue value = {0, };
+
+    g_value_init(&value, NSV_DECODER_TYPE_REQUEST);
+    g_value_take_boxed(&value, dbus_g_type_specialized_construct(
+                         NSV_DECODER_TYPE_REQUEST));
+    dbus_g_type_struct_set(&value,
+                           0, category,
+                           1, source_file,
+                           2, target_file,
+                           3, options,
+                           G_MAXUINT);
+    g_ptr_array_add(self->priv->batch, g_value_dup_boxed(&value));
+    g_value_unset(&value);
+    g_hash_table_unref(options);
+    g_free(target_file);
+    return;
+  }
 
   proxy = self->priv->proxy;
   data = g_slice_new(struct nsv_decoder_decode_data);
   data->cb = _nsv_decoder_decode_finished_cb;
   data->decoder = self;
 
-  dbus_g_proxy_begin_call(proxy, "Decode", _nsv_decoder_decode_cb, data,
-                          _nsv_decoder_decode_destroy_notify_cb,
+  dbus_g_proxy_begin_call(proxy, "DecodeWithOptions", _nsv_decoder_decode_cb,
+                          data, _nsv_decoder_decode_destroy_notify_cb,
                           G_TYPE_STRING, category,
                           G_TYPE_STRING, source_file,
                           G_TYPE_STRING, target_file,
+                          NSV_DECODER_TYPE_OPTIONS, options,
                           G_TYPE_INVALID);
+  g_hash_table_unref(options);
   g_free(target_file);
 }
+
+void
+nsv_decoder_decode(NsvDecoder *self, const gchar *category,
+                   const gchar *source_file)
+{
+  _nsv_decoder_decode(self, category, source_file, FALSE);
+}
+
+void
+nsv_decoder_supersede(NsvDecoder *self, const gchar *category,
+                      const gchar *source_file)
+{
+  _nsv_decoder_decode(self, category, source_file, TRUE);
+}
+
+void
+nsv_decoder_cancel(NsvDecoder *self, const gchar *source_file)
+{
+  NsvDecoderPrivate *priv = self->priv;
+
+  if (!source_file || !g_hash_table_contains(priv->pending, source_file))
+    return;
+
+  if (priv->in_process && priv->worker)
+  {
+    struct nsv_decoder_worker_call *call =
+        g_slice_new0(struct nsv_decoder_worker_call);
+
+    call->worker = priv->worker;
+    call->source_file = g_strdup(source_file);
+    _nsv_decoder_worker_call(priv->worker, _nsv_decoder_worker_cancel_cb,
+                             call);
+    return;
+  }
+
+  dbus_g_proxy_call_no_reply(priv->proxy, "Cancel",
+                             G_TYPE_STRING, source_file,
+                             G_TYPE_INVALID);
+}
+
+void
+nsv_decoder_promote(NsvDecoder *self, const gchar *source_file)
+{
+  NsvDecoderPrivate *priv = self->priv;
+
+  if (!source_file || !g_hash_table_contains(priv->pending, source_file))
+    return;
+
+  if (priv->in_process && priv->worker)
+  {
+    struct nsv_decoder_worker_call *call =
+        g_slice_new0(struct nsv_decoder_worker_call);
+
+    call->worker = priv->worker;
+    call->source_file = g_strdup(source_file);
+    _nsv_decoder_worker_call(priv->worker, _nsv_decoder_worker_promote_cb,
+                             call);
+    return;
+  }
+
+  dbus_g_proxy_call_no_reply(self->priv->proxy, "Promote",
+                             G_TYPE_STRING, source_file,
+                             G_TYPE_INVALID);
+}
+
+void
+nsv_decoder_begin_batch(NsvDecoder *self)
+{
+  NsvDecoderPrivate *priv = self->priv;
+
+  if (!priv->batch)
+  {
+    priv->batch = (GPtrArray *)dbus_g_type_specialized_construct(
+          NSV_DECODER_TYPE_REQUESTS);
+  }
+
+  priv->batch_ended = FALSE;
+}
+
+static void
+_nsv_decoder_decode_many_cb(DBusGProxy *proxy, DBusGProxyCall *call_id,
+                            gpointer user_data)
+{
+  GError *error = NULL;
+  guint batch = 0;
+
+  if (dbus_g_proxy_end_call(proxy, call_id, &error,
+                            G_TYPE_UINT, &batch,
+                            G_TYPE_INVALID))
+  {
+    g_debug("Decoder accepted batch %u", batch);
+  }
+  else
+  {
+    g_warning("DecodeMany failed: %s", error->message);
+    g_error_free(error);
+  }
+}
+
+static void
+_nsv_decoder_flush_batch(NsvDecoder *self)
+{
+  NsvDecoderPrivate *priv = self->priv;
+  GPtrArray *batch = priv->batch;
+
+  priv->batch = NULL;
+  priv->batch_ended = FALSE;
+  _nsv_decoder_flush_index(self);
+
+  if (batch->len)
+  {
+    dbus_g_proxy_begin_call(priv->proxy, "DecodeMany",
+                            _nsv_decoder_decode_many_cb, NULL, NULL,
+                            NSV_DECODER_TYPE_REQUESTS, batch,
+                            G_TYPE_INVALID);
+  }
+
+  g_boxed_free(NSV_DECODER_TYPE_REQUESTS, batch);
+}
+
+void
+nsv_decoder_end_batch(NsvDecoder *self)
+{
+  NsvDecoderPrivate *priv = self->priv;
+
+  if (!priv->batch)
+    return;
+
+  /* what is still being hashed goes out with it */
+  if (priv->hashing)
+    priv->batch_ended = TRUE;
+  else
+    _nsv_decoder_flush_batch(self);
+}
+
+void
+nsv_decoder_remove_decoded(NsvDecoder *self, const gchar *source_file)
+{
+  NsvDecoderPrivate *priv = self->priv;
+  struct nsv_decoder_index_entry *entry;
+  gchar *digest = NULL;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  GDir *dir = NULL;
+  const gchar *name;
+
+  if (!source_file)
+    return;
+
+  _nsv_decoder_load_index(self);
+  entry = (struct nsv_decoder_index_entry *)g_hash_table_lookup(priv->index,
+                                                                source_file);
+
+  if (entry)
+  {
+    digest = g_strdup(entry->digest);
+    g_hash_table_iter_init(&iter, priv->index);
+
+    /* keep it if another tone has the same content */
+    while (digest && g_hash_table_iter_next(&iter, &key, &value))
+    {
+      if (value != entry &&
+          g_str_equal(((struct nsv_decoder_index_entry *)value)->digest,
+                      entry->digest))
+      {
+        g_free(digest);
+        digest = NULL;
+      }
+    }
+
+    g_hash_table_remove(priv->index, source_file);
+    _nsv_decoder_index_changed(self);
+  }
+
+  if (digest)
+    dir = g_dir_open(_nsv_decoder_get_target_path(self), 0, NULL);
+
+  /* whatever format and spec it was decoded to, but not a running decode */
+  while (dir && (name = g_dir_read_name(dir)))
+  {
+    if (g_str_has_prefix(name, digest) && name[strlen(digest)] == '-' &&
+        !g_str_has_suffix(name, ".part"))
+    {
+      gchar *decoded = g_build_filename(_nsv_decoder_get_target_path(self),
+                                        name, NULL);
+
+      g_unlink(decoded);
+      g_free(decoded);
+    }
+  }
+
+  if (dir)
+    g_dir_close(dir);
+
+  g_free(digest);
+  _nsv_decoder_remove_legacy(self, source_file);
+}
+
+/* short enough that neither the fade nor the cut-off would touch it */
+gboolean
+nsv_decoder_plays_as_decoded(NsvDecoder *self, const gchar *source_file)
+{
+  return nsv_util_readable_sound_file(
+        source_file, NSV_DECODER_TASK_CUT_OFF - NSV_DECODER_TASK_FADE_LENGTH);
+}
@@ -5,6 +5,14 @@ typedef struct _NsvDecoder NsvDecoder;
 
 NsvDecoder *nsv_decoder_new();
 gchar *nsv_decoder_get_decoded_filename(NsvDecoder *self, const gchar *target_file);
+gchar *nsv_decoder_get_partial_filename(NsvDecoder *self, const gchar *source_file);
 void nsv_decoder_decode(NsvDecoder *self, const gchar *category, const gchar *source_file);
+void nsv_decoder_supersede(NsvDecoder *self, const gchar *category, const gchar *source_file);
+void nsv_decoder_cancel(NsvDecoder *self, const gchar *source_file);
+void nsv_decoder_promote(NsvDecoder *self, const gchar *source_file);
+void nsv_decoder_begin_batch(NsvDecoder *self);
+void nsv_decoder_end_batch(NsvDecoder *self);
+void nsv_decoder_remove_decoded(NsvDecoder *self, const gchar *source_file);
+gboolean nsv_decoder_plays_as_decoded(NsvDecoder *self, const gchar *source_file);
 
 #endif // NSVDECODER_H
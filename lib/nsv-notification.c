@@ -6,6 +6,7 @@
 
 #include "nsv-private.h"
 #include "nsv-notification.h"
+#include "nsv-playback.h"
 #include "nsv-util.h"
 
 struct nsv_notification_manager
@@ -375,6 +376,34 @@ nsv_notification_error(struct nsv_notification *n)
   }
 }
 
+int
+nsv_notification_get_latency(struct nsv_notification *n)
+{
+  struct notification_impl *event = get_implementation(n);
+
+  if (event)
+    return event->latency;
+
+  return NSV_PLAYBACK_LATENCY_NORMAL;
+}
+
+int
+nsv_notification_get_category_priority(const char *category)
+{
+  struct notification_impl *event = NULL;
+
+  if (mgr && category)
+  {
+    event =
+        (struct notification_impl *)g_hash_table_lookup(mgr->events, category);
+  }
+
+  if (event)
+    return event->priority;
+
+  return 0;
+}
+
 void
 nsv_notification_register(const char *type, struct notification_impl *event)
 {
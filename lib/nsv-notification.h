@@ -25,6 +25,7 @@ struct notification_impl
   const char *type;
   int priority;
   int flags;
+  int latency;
 };
 
 gboolean nsv_notification_init();
@@ -35,6 +36,8 @@ void nsv_notification_finish(struct nsv_notification *n);
 void nsv_notification_finish_by_sender(const char *sender);
 void nsv_notification_finish_by_category(const char *category);
 void nsv_notification_error(struct nsv_notification *n);
+int nsv_notification_get_latency(struct nsv_notification *n);
+int nsv_notification_get_category_priority(const char *category);
 
 gint nsv_notification_start(struct nsv_notification *n);
 void nsv_notification_stop(gint id);
@@ -1,6 +1,5 @@
 #include <glib-object.h>
 #include <libplayback/playback.h>
-#include <pulse/glib-mainloop.h>
 #include <pulse/pulseaudio.h>
 #include <pulse/ext-stream-restore.h>
 #include <sndfile.h>
@@ -8,17 +7,36 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <errno.h>
 #include <string.h>
 
 #include "config.h"
 
 #include "nsv-playback.h"
+#include "nsv-buffer-arena.h"
+#include "nsv-pulse-context.h"
+#include "nsv-sample-cache.h"
+#include "nsv-stream-pool.h"
+#include "nsv-util.h"
 
 #define NSV_TYPE_PLAYBACK (nsv_playback_get_type ())
 #define NSV_PLAYBACK(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
             NSV_TYPE_PLAYBACK, NsvPlayback))
 
+/* how often to look for more data in a file that is still being decoded */
+#define NSV_PLAYBACK_FOLLOW_INTERVAL 20
+#define NSV_PLAYBACK_HEADER_SIZE 1024
+
+/* how long a stream may take to start before max-timeout counts anyway */
+#define NSV_PLAYBACK_START_GRACE 1000
+
+/* the gap is one seek, it has to stay well within the server's maxlength */
+#define NSV_PLAYBACK_MAX_REPEAT_GAP 5000
+
+/* the stream-restore rule that carries the notification volume */
+#define NSV_PLAYBACK_RESTORE_ID "x-maemo-hildon-notify"
+
 typedef struct _NsvPlaybackClass NsvPlaybackClass;
 typedef struct _NsvPlaybackPrivate NsvPlaybackPrivate;
 
@@ -31,7 +49,27 @@ enum
   PROP_PLAYBACK_MIN_TIMEOUT,
   PROP_PLAYBACK_MAX_TIMEOUT,
   PROP_PLAYBACK_EVENT_ID,
-  PROP_PLAYBACK_MEDIA_ROLE
+  PROP_PLAYBACK_MEDIA_ROLE,
+  PROP_PLAYBACK_REPEAT_GAP,
+  PROP_PLAYBACK_LATENCY
+};
+
+struct nsv_latency_profile
+{
+  const char *name;
+  pa_usec_t tlength;
+  pa_usec_t minreq;
+  pa_usec_t prebuf;
+  pa_stream_flags_t flags;
+};
+
+/* indexed by NsvPlaybackLatency */
+static const struct nsv_latency_profile latency_profiles[] =
+{
+  {"normal", 200000, 50000, 50000, PA_STREAM_ADJUST_LATENCY},
+  {"low", 40000, 10000, 10000, PA_STREAM_ADJUST_LATENCY},
+  /* let the sink run with its biggest buffer and wake us up rarely */
+  {"power-saving", 4000000, 1000000, 100000, PA_STREAM_NOFLAGS}
 };
 
 struct _NsvPlayback
@@ -51,28 +89,46 @@ struct _NsvPlaybackPrivate
   gboolean volume_set;
   gint volume;
   gboolean repeat;
+  gint repeat_gap;
+  gint latency;
   gint min_timeout;
   gint max_timeout;
   gchar *event_id;
   gchar *media_role;
-  GTimer *timer;
-  guint check_repeat_id;
-  guint max_timeout_id;
-  guint repeat_id;
+  guint timeout_id;
+  gint64 start_time;
+  gint64 sample_end_time;
+  gboolean drained;
+  pa_operation *sample_op;
+  pa_usec_t sample_duration;
   int field_30;
   int handle;
   int last_errno;
   SNDFILE *sndfile;
-  pa_glib_mainloop *pa_glib_mainloop;
-  pa_context *pa_context;
+  NsvPulseContext *pulse_context;
   pa_stream *pa_stream;
+  pa_sample_spec spec;
+  pa_buffer_attr buffer_attr;
   uint32_t stream_index;
+  int64_t seek_offset;
+  gsize loop_bytes;
   FILE *fp;
+  long fp_offset;
+  long fp_end;
+  gboolean partial;
+  guint follow_id;
+  GMappedFile *mapped;
+  const guint8 *data;
+  gsize data_length;
+  gsize data_pos;
   gboolean decoded;
+  gboolean convert;
   gboolean started;
   gboolean stopped;
   gboolean play_pending;
-  char buffer[65536];
+  gint64 stage_time[NSV_PLAYBACK_STAGE_LAST];
+  gpointer buffer;
+  gsize buffer_size;
 };
 
 G_DEFINE_TYPE(NsvPlayback, nsv_playback, G_TYPE_OBJECT);
@@ -84,46 +140,103 @@ static guint succeeded_id;
 static guint stopped_id;
 static guint error_id;
 
+/* delays from nsv_playback_play(), bucket n counts [2^(n-1), 2^n) us */
+static guint histograms[NSV_PLAYBACK_STAGE_LAST][NSV_PLAYBACK_HISTOGRAM_SIZE];
+
 static void _nsv_playback_play_real(NsvPlayback *self);
 
+static void
+_nsv_playback_mark(NsvPlayback *self, NsvPlaybackStage stage)
+{
+  NsvPlaybackPrivate *priv = self->priv;
+  gint64 start = priv->stage_time[NSV_PLAYBACK_STAGE_PLAY];
+  guint bucket;
+
+  /* only the first loop of a repeated file counts */
+  if (priv->stage_time[stage])
+    return;
+
+  priv->stage_time[stage] = g_get_monotonic_time();
+
+  if (stage == NSV_PLAYBACK_STAGE_PLAY || !start)
+    return;
+
+  bucket = g_bit_storage(priv->stage_time[stage] - start);
+  histograms[stage][MIN(bucket, NSV_PLAYBACK_HISTOGRAM_SIZE - 1)]++;
+}
+
 static void
 _nsv_playback_cleanup(NsvPlayback *self)
 {
   NsvPlaybackPrivate *priv = self->priv;
 
-  if (priv->repeat_id)
+  if (priv->timeout_id)
   {
-    g_source_remove(priv->repeat_id);
-    priv->repeat_id = 0;
+    g_source_remove(priv->timeout_id);
+    priv->timeout_id = 0;
   }
 
-  if (priv->check_repeat_id)
+  if (priv->follow_id)
   {
-    g_source_remove(priv->check_repeat_id);
-    priv->check_repeat_id = 0;
+    g_source_remove(priv->follow_id);
+    priv->follow_id = 0;
   }
 
-  if (priv->max_timeout_id)
+  if (priv->sample_end_time && !priv->drained)
   {
-    g_source_remove(priv->max_timeout_id);
-    priv->max_timeout_id = 0;
+    pa_context *pa_context =
+        nsv_pulse_context_get_context(priv->pulse_context);
+
+    /* still playing from the sample cache, kill the sink input */
+    if (pa_context && pa_context_get_state(pa_context) == PA_CONTEXT_READY)
+    {
+      pa_operation *op =
+          pa_context_kill_sink_input(pa_context, priv->stream_index, NULL,
+                                     NULL);
+
+      if (op)
+        pa_operation_unref(op);
+    }
+  }
+
+  priv->sample_end_time = 0;
+
+  if (priv->sample_op)
+  {
+    pa_operation_cancel(priv->sample_op);
+    pa_operation_unref(priv->sample_op);
+    priv->sample_op = NULL;
   }
 
   if (priv->pa_stream)
   {
     pa_stream_set_state_callback(priv->pa_stream, NULL, NULL);
     pa_stream_set_write_callback(priv->pa_stream, NULL, NULL);
+    pa_stream_set_started_callback(priv->pa_stream, NULL, NULL);
     pa_stream_disconnect(priv->pa_stream);
     pa_stream_unref(priv->pa_stream);
     priv->pa_stream = NULL;
   }
 
+  if (priv->buffer)
+  {
+    nsv_buffer_arena_free(priv->buffer, priv->buffer_size);
+    priv->buffer = NULL;
+  }
+
   if (priv->fp)
   {
     fclose(priv->fp);
     priv->fp = NULL;
   }
 
+  if (priv->mapped)
+  {
+    g_mapped_file_unref(priv->mapped);
+    priv->mapped = NULL;
+    priv->data = NULL;
+  }
+
   if (priv->sndfile)
   {
     sf_close(priv->sndfile);
@@ -145,18 +258,13 @@ nsv_playback_finalize(GObject *object)
 
   _nsv_playback_cleanup(self);
 
-  if (priv->pa_context)
+  if (priv->pulse_context)
   {
-    pa_context_set_state_callback(priv->pa_context, NULL, NULL);
-    pa_context_disconnect(priv->pa_context);
-    pa_context_unref(priv->pa_context);
-    priv->pa_context = NULL;
-  }
-
-  if (priv->pa_glib_mainloop)
-  {
-    pa_glib_mainloop_free(priv->pa_glib_mainloop);
-    priv->pa_glib_mainloop = NULL;
+    g_signal_handlers_disconnect_matched(priv->pulse_context,
+                                         G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL,
+                                         self);
+    g_object_unref(priv->pulse_context);
+    priv->pulse_context = NULL;
   }
 
   if (priv->filename)
@@ -177,8 +285,6 @@ nsv_playback_finalize(GObject *object)
     priv->media_role = NULL;
   }
 
-  g_timer_destroy(priv->timer);
-  priv->timer = NULL;
   g_free(self->priv);
   self->priv = NULL;
 
@@ -195,7 +301,10 @@ _nsv_playback_pa_set_volume(NsvPlayback *self, gint volume)
   const pa_ext_stream_restore_info *pinfo = &info;
   pa_cvolume cvol;
 
-  pa_context = self->priv->pa_context;
+  if (!priv->pulse_context)
+    return FALSE;
+
+  pa_context = nsv_pulse_context_get_context(priv->pulse_context);
 
   if (pa_context && pa_context_get_state(pa_context) == PA_CONTEXT_READY)
   {
@@ -207,14 +316,14 @@ _nsv_playback_pa_set_volume(NsvPlayback *self, gint volume)
     v = ((double)volume / 100.0 * 65536.0);
     pa_cvolume_set(&cvol, 1, v);
 
-    info.name = "x-maemo-hildon-notify";
+    info.name = NSV_PLAYBACK_RESTORE_ID;
     info.channel_map.channels = 1;
     info.channel_map.map[0] = 0;
     info.volume = cvol;
     info.device = 0;
     info.mute = FALSE;
 
-    op = pa_ext_stream_restore_write(priv->pa_context,PA_UPDATE_REPLACE,
+    op = pa_ext_stream_restore_write(pa_context, PA_UPDATE_REPLACE,
                                      pinfo, 1, TRUE, NULL, NULL);
     if (op)
       pa_operation_unref(op);
@@ -254,6 +363,16 @@ nsv_playback_set_property(GObject *object, guint prop_id, const GValue *value,
       priv->repeat = g_value_get_boolean(value);
       break;
     }
+    case PROP_PLAYBACK_REPEAT_GAP:
+    {
+      priv->repeat_gap = g_value_get_int(value);
+      break;
+    }
+    case PROP_PLAYBACK_LATENCY:
+    {
+      priv->latency = g_value_get_int(value);
+      break;
+    }
     case PROP_PLAYBACK_MIN_TIMEOUT:
     {
       priv->min_timeout = g_value_get_int(value);
@@ -308,6 +427,16 @@ nsv_playback_get_property(GObject *object, guint prop_id, GValue *value,
     case PROP_PLAYBACK_REPEAT:
       g_value_set_boolean(value, priv->repeat);
       break;
+    case PROP_PLAYBACK_REPEAT_GAP:
+    {
+      g_value_set_int(value, priv->repeat_gap);
+      break;
+    }
+    case PROP_PLAYBACK_LATENCY:
+    {
+      g_value_set_int(value, priv->latency);
+      break;
+    }
     case PROP_PLAYBACK_MIN_TIMEOUT:
     {
       g_value_set_int(value, priv->min_timeout);
@@ -365,6 +494,21 @@ nsv_playback_class_init(NsvPlaybackClass *klass)
                              NULL, NULL, FALSE,
                              G_PARAM_CONSTRUCT | G_PARAM_READWRITE));
 
+  /* silence between two loops of a repeated file, in ms */
+  g_object_class_install_property(
+        object_class, PROP_PLAYBACK_REPEAT_GAP,
+        g_param_spec_int("repeat-gap",
+                         NULL, NULL, 0, NSV_PLAYBACK_MAX_REPEAT_GAP, 1000,
+                         G_PARAM_CONSTRUCT | G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+        object_class, PROP_PLAYBACK_LATENCY,
+        g_param_spec_int("latency",
+                         NULL, NULL, NSV_PLAYBACK_LATENCY_NORMAL,
+                         NSV_PLAYBACK_LATENCY_POWER_SAVING,
+                         NSV_PLAYBACK_LATENCY_NORMAL,
+                         G_PARAM_CONSTRUCT | G_PARAM_READWRITE));
+
   g_object_class_install_property(
         object_class, PROP_PLAYBACK_MIN_TIMEOUT,
         g_param_spec_int("min-timeout",
@@ -422,51 +566,130 @@ _nsv_playback_emit_error_cb(gpointer user_data)
   return FALSE;
 }
 
+static void _nsv_playback_finished(NsvPlayback *self);
+
 static gboolean
-_nsv_playback_repeat_cb(gpointer user_data)
+_nsv_playback_timeout_cb(gpointer user_data)
 {
   NsvPlayback *self = NSV_PLAYBACK(user_data);
+  NsvPlaybackPrivate *priv = self->priv;
+
+  priv->timeout_id = 0;
 
-  self->priv->repeat_id = 0;
+  /* a cached sample has no drain, its end is only known from the clock */
+  if (!priv->drained && priv->sample_end_time &&
+      g_get_monotonic_time() >= priv->sample_end_time)
+  {
+    _nsv_playback_finished(self);
+    return FALSE;
+  }
+
+  /* either min-timeout after the drain or max-timeout, that also ends a
+   * looping stream */
   _nsv_playback_cleanup(self);
-  _nsv_playback_play_real(self);
+  g_signal_emit(self, succeeded_id, 0);
 
   return FALSE;
 }
 
 static gboolean
-_nsv_playback_repeat(NsvPlayback *self)
+_nsv_playback_schedule(NsvPlayback *self)
 {
   NsvPlaybackPrivate *priv = self->priv;
+  gint64 deadline = G_MAXINT64;
+  gint64 now = g_get_monotonic_time();
 
-  if (priv->repeat)
+  if (priv->timeout_id)
   {
-    priv->repeat_id = g_timeout_add(1000, _nsv_playback_repeat_cb, self);
-    return TRUE;
+    g_source_remove(priv->timeout_id);
+    priv->timeout_id = 0;
   }
 
-  return FALSE;
+  if (priv->drained)
+  {
+    if (priv->min_timeout <= 0)
+      return FALSE;
+
+    deadline = priv->start_time + (gint64)priv->min_timeout * 1000;
+
+    /* not worth a wakeup */
+    if (deadline - now <= 50000)
+      return FALSE;
+  }
+  else
+  {
+    /* armed when the stream is requested, so a stream that never starts
+     * still ends, and tightened to the audio clock once it does start */
+    if (priv->max_timeout > 0)
+    {
+      deadline = priv->stage_time[NSV_PLAYBACK_STAGE_CONTEXT_READY] +
+          ((gint64)priv->max_timeout + NSV_PLAYBACK_START_GRACE) * 1000;
+
+      if (priv->start_time)
+      {
+        deadline = MIN(deadline,
+                       priv->start_time + (gint64)priv->max_timeout * 1000);
+      }
+    }
+
+    if (priv->sample_end_time)
+      deadline = MIN(deadline, priv->sample_end_time);
+
+    if (deadline == G_MAXINT64)
+      return FALSE;
+  }
+
+  priv->timeout_id = g_timeout_add(MAX(deadline - now, 0) / 1000 + 1,
+                                   _nsv_playback_timeout_cb, self);
+
+  return TRUE;
 }
 
-static gboolean
-_nsv_playback_emit_succeeded_cb(gpointer user_data)
+static void
+_nsv_playback_audio_started(NsvPlayback *self)
 {
-  NsvPlayback *self = NSV_PLAYBACK(user_data);
+  NsvPlaybackPrivate *priv = self->priv;
+
+  /* PA reports a start again after every underrun */
+  if (priv->start_time)
+    return;
+
+  priv->start_time = g_get_monotonic_time();
+  _nsv_playback_mark(self, NSV_PLAYBACK_STAGE_STARTED);
+  _nsv_playback_schedule(self);
+}
+
+static void
+_nsv_playback_stream_ready(NsvPlayback *self)
+{
+  NsvPlaybackPrivate *priv = self->priv;
+  const pa_buffer_attr *attr = pa_stream_get_buffer_attr(priv->pa_stream);
 
-  if (!_nsv_playback_repeat(self))
+  priv->stream_index = pa_stream_get_index(priv->pa_stream);
+  _nsv_playback_mark(self, NSV_PLAYBACK_STAGE_STREAM_READY);
+
+  if (attr)
   {
-    _nsv_playback_cleanup(self);
-    g_signal_emit(self, succeeded_id, 0);
+    priv->buffer_attr = *attr;
+    g_debug("Stream '%s' (%s latency) got tlength %llu us, minreq %llu us, "
+            "prebuf %llu us", priv->filename,
+            latency_profiles[priv->latency].name,
+            (unsigned long long)pa_bytes_to_usec(attr->tlength, &priv->spec),
+            (unsigned long long)pa_bytes_to_usec(attr->minreq, &priv->spec),
+            (unsigned long long)pa_bytes_to_usec(attr->prebuf, &priv->spec));
   }
+}
 
-  return FALSE;
+static void
+_nsv_playback_stream_started_cb(pa_stream *p, void *userdata)
+{
+  _nsv_playback_audio_started(NSV_PLAYBACK(userdata));
 }
 
 static void
 _nsv_playback_stream_state_cb(pa_stream *p, void *userdata)
 {
   NsvPlayback *self = NSV_PLAYBACK(userdata);
-  NsvPlaybackPrivate *priv = self->priv;
   pa_stream_state_t stream_state = pa_stream_get_state(p);
 
   if (stream_state == PA_STREAM_FAILED || stream_state == PA_STREAM_TERMINATED)
@@ -475,55 +698,208 @@ _nsv_playback_stream_state_cb(pa_stream *p, void *userdata)
     g_idle_add(_nsv_playback_emit_error_cb, self);
   }
   else if (stream_state == PA_STREAM_READY)
+    _nsv_playback_stream_ready(self);
+}
+
+static gint64
+_nsv_playback_stage_delay(NsvPlayback *self, NsvPlaybackStage stage)
+{
+  gint64 *t = self->priv->stage_time;
+
+  if (!t[stage] || !t[NSV_PLAYBACK_STAGE_PLAY])
+    return -1;
+
+  return t[stage] - t[NSV_PLAYBACK_STAGE_PLAY];
+}
+
+static void
+_nsv_playback_finished(NsvPlayback *self)
+{
+  NsvPlaybackPrivate *priv = self->priv;
+
+  _nsv_playback_mark(self, NSV_PLAYBACK_STAGE_DRAINED);
+  g_debug("Playback of '%s' took %" G_GINT64_FORMAT " us to context, %"
+          G_GINT64_FORMAT " us to stream, %" G_GINT64_FORMAT
+          " us to first write, %" G_GINT64_FORMAT " us to start, %"
+          G_GINT64_FORMAT " us to drain", priv->filename,
+          _nsv_playback_stage_delay(self, NSV_PLAYBACK_STAGE_CONTEXT_READY),
+          _nsv_playback_stage_delay(self, NSV_PLAYBACK_STAGE_STREAM_READY),
+          _nsv_playback_stage_delay(self, NSV_PLAYBACK_STAGE_FIRST_WRITE),
+          _nsv_playback_stage_delay(self, NSV_PLAYBACK_STAGE_STARTED),
+          _nsv_playback_stage_delay(self, NSV_PLAYBACK_STAGE_DRAINED));
+
+  /* a file shorter than prebuf may drain before PA reported the start */
+  if (!priv->start_time)
+    priv->start_time = priv->stage_time[NSV_PLAYBACK_STAGE_CONTEXT_READY];
+
+  priv->drained = TRUE;
+
+  if (!priv->stopped && !_nsv_playback_schedule(self))
+    g_signal_emit(self, succeeded_id, 0);
+}
+
+static void
+_nsv_playback_stream_timing_cb(pa_stream *s, int success, void *userdata)
+{
+  NsvPlayback *self = NSV_PLAYBACK(userdata);
+  NsvPlaybackPrivate *priv = self->priv;
+  pa_usec_t usec;
+
+  /* the stream clock says how long we have really been playing */
+  if (success && pa_stream_get_time(s, &usec) >= 0 && usec > 0)
+    priv->start_time = g_get_monotonic_time() - usec;
+
+  _nsv_playback_finished(self);
+}
+
+static void
+_nsv_playback_pa_stream_drain_cb(pa_stream *s, int success, void *userdata)
+{
+  NsvPlayback *self = NSV_PLAYBACK(userdata);
+  pa_operation *op;
+
+  op = pa_stream_update_timing_info(s, _nsv_playback_stream_timing_cb, self);
+
+  if (op)
+    pa_operation_unref(op);
+  else
+    _nsv_playback_finished(self);
+}
+
+static gboolean
+_nsv_playback_rewind(NsvPlayback *self)
+{
+  NsvPlaybackPrivate *priv = self->priv;
+
+  /* nothing was written since the last rewind, don't spin on an empty file */
+  if (!priv->repeat || !priv->loop_bytes)
+    return FALSE;
+
+  if (priv->mapped)
+    priv->data_pos = 0;
+  else if (priv->fp)
   {
-    priv->stream_index = pa_stream_get_index(priv->pa_stream);
+    if (fseek(priv->fp, priv->fp_offset, SEEK_SET))
+      return FALSE;
   }
+  else if (sf_seek(priv->sndfile, 0, SEEK_SET) < 0)
+    return FALSE;
+
+  /* PA fills the hole left by the seek with silence */
+  priv->seek_offset =
+      pa_usec_to_bytes((pa_usec_t)priv->repeat_gap * PA_USEC_PER_MSEC,
+                       &priv->spec);
+  priv->loop_bytes = 0;
+
+  return TRUE;
 }
 
+static void
+_nsv_playback_stream_write_cb(pa_stream *p, size_t nbytes, void *userdata);
+
 static gboolean
-_nsv_playback_check_repeat_cb(gpointer user_data)
+_nsv_playback_follow_cb(gpointer user_data)
 {
   NsvPlayback *self = NSV_PLAYBACK(user_data);
   NsvPlaybackPrivate *priv = self->priv;
+  size_t writable;
 
-  if (!_nsv_playback_repeat(self))
-    g_signal_emit(self, succeeded_id, 0);
+  priv->follow_id = 0;
+  writable = pa_stream_writable_size(priv->pa_stream);
 
-  priv->check_repeat_id = 0;
+  if (writable && writable != (size_t)-1)
+    _nsv_playback_stream_write_cb(priv->pa_stream, writable, self);
 
   return FALSE;
 }
 
-static void
-_nsv_playback_pa_stream_drain_cb(pa_stream *s, int success, void *userdata)
+static size_t
+_nsv_playback_fp_read(NsvPlayback *self, size_t bytes)
 {
-  NsvPlayback *self = NSV_PLAYBACK(userdata);
   NsvPlaybackPrivate *priv = self->priv;
-  gint min_timeout;
-  gint chk_rpt_tm;
-  double elapsed;
 
-  elapsed = g_timer_elapsed(priv->timer, 0);
+  /* anything after the data chunk is not audio */
+  if (priv->fp_end)
+  {
+    long pos = ftell(priv->fp);
+
+    if (pos < 0 || pos >= priv->fp_end)
+      return 0;
+
+    bytes = MIN(bytes, (size_t)(priv->fp_end - pos));
+  }
+
+  return fread(priv->buffer, 1, bytes, priv->fp);
+}
 
-  if (priv->max_timeout_id)
+static gboolean
+_nsv_playback_follow_done(NsvPlayback *self)
+{
+  NsvPlaybackPrivate *priv = self->priv;
+  guint8 size[4];
+  guint32 data_size;
+  struct stat st;
+
+  if (pread(fileno(priv->fp), size, sizeof(size),
+            priv->fp_offset - sizeof(size)) != sizeof(size) ||
+      fstat(fileno(priv->fp), &st))
   {
-    g_source_remove(priv->max_timeout_id);
-    priv->max_timeout_id = 0;
+    return FALSE;
   }
 
-  if (!priv->stopped)
+  /* the data size is 0 or bogus until the decoder fixed the header */
+  data_size = size[0] | (size[1] << 8) | (size[2] << 16) |
+      ((guint32)size[3] << 24);
+
+  if (!data_size || priv->fp_offset + (gint64)data_size > st.st_size)
+    return FALSE;
+
+  priv->fp_end = priv->fp_offset + data_size;
+  priv->partial = FALSE;
+
+  return TRUE;
+}
+
+static size_t
+_nsv_playback_follow_read(NsvPlayback *self, size_t bytes)
+{
+  NsvPlaybackPrivate *priv = self->priv;
+  size_t frame_size = pa_frame_size(&priv->spec);
+  gboolean growing;
+
+  /* tags and the loop chunk get appended before the file is renamed */
+  if (_nsv_playback_follow_done(self))
+    return _nsv_playback_fp_read(self, bytes);
+
+  /* look before reading, the decoder renames the file after the last write */
+  growing = g_file_test(priv->filename, G_FILE_TEST_EXISTS);
+  bytes = fread(priv->buffer, 1, bytes, priv->fp);
+
+  /* leave a torn frame for the next read */
+  if (bytes % frame_size &&
+      !fseek(priv->fp, -(long)(bytes % frame_size), SEEK_CUR))
+  {
+    bytes -= bytes % frame_size;
+  }
+
+  if (!bytes && growing)
   {
-    min_timeout = priv->min_timeout;
+    clearerr(priv->fp);
 
-    if (min_timeout > 0 &&
-        (chk_rpt_tm = min_timeout - (gint)(elapsed * 1000.0), chk_rpt_tm > 50))
+    if (!priv->follow_id)
     {
-      priv->check_repeat_id =
-          g_timeout_add(chk_rpt_tm, _nsv_playback_check_repeat_cb, self);
+      priv->follow_id = g_timeout_add(NSV_PLAYBACK_FOLLOW_INTERVAL,
+                                      _nsv_playback_follow_cb, self);
     }
-    else if (!_nsv_playback_repeat(self))
-      g_signal_emit(self, succeeded_id, 0);
+
+    return (size_t)-1;
   }
+
+  /* complete now, the rest is plain EOF handling */
+  if (!growing)
+    priv->partial = FALSE;
+
+  return bytes;
 }
 
 static void
@@ -533,38 +909,83 @@ _nsv_playback_stream_write_cb(pa_stream *p, size_t nbytes, void *userdata)
   NsvPlaybackPrivate *priv = self->priv;
   size_t bytes;
   pa_operation *op;
-  void *buf;
-  const size_t bufsize = sizeof(priv->buffer);
-
-  if (!nbytes)
-    return;
-
-  buf = priv->buffer;
 
-  do
+  while (nbytes)
   {
-    if (priv->decoded)
+    if (priv->mapped)
     {
-      bytes = fread(buf, 1, nbytes > bufsize ? bufsize : nbytes, priv->fp);
-
-      if (!bytes)
-        goto finished;
+      /* feed PA straight from the mapping, it is kept alive by the blocks */
+      bytes = MIN(nbytes, priv->data_length - priv->data_pos);
+
+      if (bytes)
+      {
+        g_mapped_file_ref(priv->mapped);
+
+        if (pa_stream_write_ext_free(p, priv->data + priv->data_pos, bytes,
+                                     (pa_free_cb_t)g_mapped_file_unref,
+                                     priv->mapped, priv->seek_offset,
+                                     PA_SEEK_RELATIVE) < 0)
+        {
+          g_mapped_file_unref(priv->mapped);
+          goto finished;
+        }
+
+        priv->data_pos += bytes;
+      }
     }
     else
     {
-      bytes =
-          sf_read_raw(priv->sndfile, buf, nbytes > bufsize ? bufsize : nbytes);
-
-      if (!bytes)
+      /* PA copies what we write, one minreq of scratch space is enough */
+      if (!priv->buffer)
+      {
+        priv->buffer = nsv_buffer_arena_alloc(
+              priv->buffer_attr.minreq ? priv->buffer_attr.minreq : nbytes,
+              &priv->buffer_size);
+      }
+
+      bytes = MIN(nbytes, priv->buffer_size);
+
+      if (priv->partial)
+      {
+        bytes = _nsv_playback_follow_read(self, bytes);
+
+        /* decoder is behind, continue when it wrote some more */
+        if (bytes == (size_t)-1)
+          return;
+      }
+      else if (priv->fp)
+        bytes = _nsv_playback_fp_read(self, bytes);
+      else if (priv->convert)
+      {
+        size_t frame_size = pa_frame_size(&priv->spec);
+
+        bytes = sf_readf_short(priv->sndfile, (short *)priv->buffer,
+                               bytes / frame_size) * frame_size;
+      }
+      else
+        bytes = sf_read_raw(priv->sndfile, priv->buffer, bytes);
+
+      if (bytes &&
+          pa_stream_write(p, priv->buffer, bytes, NULL, priv->seek_offset,
+                          PA_SEEK_RELATIVE) < 0)
+      {
         goto finished;
+      }
     }
 
-    if (pa_stream_write(p, buf, bytes, NULL, 0, PA_SEEK_RELATIVE) < 0)
-      goto finished;
+    if (!bytes)
+    {
+      if (!_nsv_playback_rewind(self))
+        goto finished;
+
+      continue;
+    }
 
+    _nsv_playback_mark(self, NSV_PLAYBACK_STAGE_FIRST_WRITE);
+    priv->seek_offset = 0;
+    priv->loop_bytes += bytes;
     nbytes -= bytes;
   }
-  while (nbytes);
 
   return;
 
@@ -576,8 +997,179 @@ finished:
     pa_operation_unref(op);
 }
 
+static const char *
+_nsv_playback_get_restore_id(NsvPlayback *self)
+{
+  return self->priv->volume_set ? NSV_PLAYBACK_RESTORE_ID : NULL;
+}
+
+static pa_proplist *
+_nsv_playback_create_proplist(NsvPlayback *self)
+{
+  NsvPlaybackPrivate *priv = self->priv;
+  pa_proplist *proplist = pa_proplist_new();
+  const char *restore_id = _nsv_playback_get_restore_id(self);
+
+  if (restore_id)
+    pa_proplist_sets(proplist, "module-stream-restore.id", restore_id);
+
+  if (priv->event_id)
+    pa_proplist_sets(proplist, "event.id",  priv->event_id);
+
+  if (priv->media_role)
+    pa_proplist_sets(proplist, "media.role", priv->media_role);
+
+  return proplist;
+}
+
+static gboolean
+_nsv_playback_map_file(NsvPlayback *self, pa_sample_spec *spec)
+{
+  NsvPlaybackPrivate *priv = self->priv;
+  const guint8 *contents;
+  gsize length;
+
+  priv->mapped = g_mapped_file_new(priv->filename, FALSE, NULL);
+
+  if (!priv->mapped)
+    return FALSE;
+
+  contents = (const guint8 *)g_mapped_file_get_contents(priv->mapped);
+  length = g_mapped_file_get_length(priv->mapped);
+
+  if (contents && priv->decoded)
+  {
+    spec->format = PA_SAMPLE_ALAW;
+    spec->channels = 1;
+    spec->rate = 48000;
+    priv->data = contents;
+    priv->data_length = length;
+  }
+  else if (contents)
+  {
+    struct nsv_wav_info info;
+
+    if (!nsv_util_wav_parse(contents, length, &info))
+      goto unmap;
+
+    *spec = info.spec;
+    priv->data = contents + info.data_offset;
+    priv->data_length = info.data_length;
+
+    /* repeat the clean loop the decoder found, without the silence around */
+    if (priv->repeat && info.loop_length)
+    {
+      priv->data += info.loop_offset;
+      priv->data_length = info.loop_length;
+    }
+  }
+  else
+    goto unmap;
+
+  priv->data_pos = 0;
+
+  return TRUE;
+
+unmap:
+  g_mapped_file_unref(priv->mapped);
+  priv->mapped = NULL;
+
+  return FALSE;
+}
+
+static gboolean
+_nsv_playback_follow_file(NsvPlayback *self, pa_sample_spec *spec)
+{
+  NsvPlaybackPrivate *priv = self->priv;
+  guint8 header[NSV_PLAYBACK_HEADER_SIZE];
+  struct nsv_wav_info info;
+  size_t length;
+
+  priv->fp = fopen(priv->filename, "rb");
+
+  if (!priv->fp)
+    return FALSE;
+
+  /* the sizes in the header are provisional until the decoder is done */
+  length = fread(header, 1, sizeof(header), priv->fp);
+
+  if (!nsv_util_wav_parse(header, length, &info) ||
+      fseek(priv->fp, info.data_offset, SEEK_SET))
+  {
+    fclose(priv->fp);
+    priv->fp = NULL;
+
+    return FALSE;
+  }
+
+  *spec = info.spec;
+  priv->fp_offset = info.data_offset;
+
+  return TRUE;
+}
+
 static void
-_nsv_playback_play_real(NsvPlayback *self)
+_nsv_playback_get_buffer_attr(int latency, const pa_sample_spec *spec,
+                              pa_buffer_attr *attr)
+{
+  const struct nsv_latency_profile *profile = &latency_profiles[latency];
+
+  attr->maxlength = -1;
+  attr->tlength = pa_usec_to_bytes(profile->tlength, spec);
+  attr->minreq = pa_usec_to_bytes(profile->minreq, spec);
+  attr->prebuf = pa_usec_to_bytes(profile->prebuf, spec);
+  attr->fragsize = -1;
+}
+
+static gboolean
+_nsv_playback_stream_start_pooled(NsvPlayback *self)
+{
+  NsvPlaybackPrivate *priv = self->priv;
+  pa_proplist *proplist;
+  pa_operation *op;
+  size_t writable;
+
+  /* the pool is keyed on the stream-restore id too, it can't be changed */
+  priv->pa_stream = nsv_stream_pool_acquire(nsv_stream_pool_get_instance(),
+                                            &priv->spec, priv->media_role,
+                                            _nsv_playback_get_restore_id(self),
+                                            priv->latency);
+
+  if (!priv->pa_stream)
+    return FALSE;
+
+  proplist = _nsv_playback_create_proplist(self);
+  op = pa_stream_proplist_update(priv->pa_stream, PA_UPDATE_REPLACE, proplist,
+                                 NULL, NULL);
+  pa_proplist_free(proplist);
+
+  if (op)
+    pa_operation_unref(op);
+
+  pa_stream_set_state_callback(priv->pa_stream,
+                               _nsv_playback_stream_state_cb, self);
+  pa_stream_set_write_callback(priv->pa_stream,
+                               _nsv_playback_stream_write_cb, self);
+  pa_stream_set_started_callback(priv->pa_stream,
+                                 _nsv_playback_stream_started_cb, self);
+  _nsv_playback_stream_ready(self);
+
+  /* the request for the initial fill was made while nobody was listening */
+  writable = pa_stream_writable_size(priv->pa_stream);
+
+  if (writable != (size_t)-1)
+    _nsv_playback_stream_write_cb(priv->pa_stream, writable, self);
+
+  op = pa_stream_cork(priv->pa_stream, 0, NULL, NULL);
+
+  if (op)
+    pa_operation_unref(op);
+
+  return TRUE;
+}
+
+static gboolean
+_nsv_playback_stream_start(NsvPlayback *self)
 {
   NsvPlaybackPrivate *priv = self->priv;
   pa_proplist *proplist;
@@ -585,112 +1177,202 @@ _nsv_playback_play_real(NsvPlayback *self)
   pa_buffer_attr attr;
   pa_sample_spec spec;
 
-  if (!priv->filename)
-    return;
-
-  _nsv_playback_pa_set_volume(self, priv->volume);
-
   if (g_str_has_suffix(priv->filename, ".decoded"))
     priv->decoded = TRUE;
 
-  if (priv->decoded)
-  {
-    priv->fp = fopen(priv->filename, "rb");
-
-    if (!priv->fp)
-      goto emit_error;
+  priv->seek_offset = 0;
+  priv->loop_bytes = 0;
+  priv->fp_offset = 0;
+  priv->fp_end = 0;
+  priv->convert = FALSE;
+  priv->partial = FALSE;
 
-    spec.format = PA_SAMPLE_ALAW;
-    spec.channels = 1;
-    spec.rate = 48000;
-  }
-  else
+  /* still being decoded, play along while the file grows */
+  if (g_str_has_suffix(priv->filename, ".part"))
   {
-    priv->handle = open(priv->filename, 0);
+    priv->partial = _nsv_playback_follow_file(self, &spec);
 
-    if (priv->handle == -1)
+    if (!priv->partial)
     {
-      g_warning("Unable to open file descriptor '%s': %s (%d)", priv->filename,
-                strerror(errno), errno);
-      goto emit_error;
+      gchar *filename = g_strndup(priv->filename,
+                                  strlen(priv->filename) - strlen(".part"));
+
+      /* no header yet and not finished either, leave it to the fallback */
+      if (!g_file_test(filename, G_FILE_TEST_EXISTS))
+      {
+        g_free(filename);
+        return FALSE;
+      }
+
+      /* the decoder finished it in the meantime */
+      g_free(priv->filename);
+      priv->filename = filename;
     }
+  }
 
-    priv->sndfile = sf_open_fd(priv->handle, SFM_READ, &sfinfo, 0);
+  if (!priv->partial && !_nsv_playback_map_file(self, &spec))
+  {
+    if (priv->decoded)
+    {
+      priv->fp = fopen(priv->filename, "rb");
 
-    if (!priv->sndfile)
-      goto emit_error;
+      if (!priv->fp)
+        return FALSE;
 
-    switch (sfinfo.format & 0xFFFF)
-    {
-      case SF_FORMAT_ALAW:
-        spec.format = PA_SAMPLE_ALAW;
-        break;
-      case SF_FORMAT_ULAW:
-        spec.format = PA_SAMPLE_ULAW;
-        break;
-      case SF_FORMAT_FLOAT:
-        spec.format = PA_SAMPLE_FLOAT32LE;
-        break;
-      case SF_FORMAT_PCM_U8:
-        spec.format = PA_SAMPLE_U8;
-        break;
-      case SF_FORMAT_PCM_32:
-        spec.format = PA_SAMPLE_S32LE;
-        break;
-      case SF_FORMAT_PCM_16:
-        spec.format = PA_SAMPLE_S16LE;
-        break;
-      default:
-        goto emit_error;
+      spec.format = PA_SAMPLE_ALAW;
+      spec.channels = 1;
+      spec.rate = 48000;
     }
+    else
+    {
+      priv->handle = open(priv->filename, 0);
 
-    spec.channels = sfinfo.channels;
-    spec.rate = sfinfo.samplerate;
-  }
+      if (priv->handle == -1)
+      {
+        g_warning("Unable to open file descriptor '%s': %s (%d)",
+                  priv->filename, strerror(errno), errno);
+        return FALSE;
+      }
 
-  attr.maxlength = -1;
-  attr.minreq = pa_usec_to_bytes(4000000, &spec);
-  attr.tlength = 2 * attr.minreq;
-  attr.prebuf = pa_usec_to_bytes(2000000, &spec);
-  attr.fragsize = -1;
+      priv->sndfile = sf_open_fd(priv->handle, SFM_READ, &sfinfo, 0);
 
-  proplist = pa_proplist_new();
+      if (!priv->sndfile)
+        return FALSE;
 
-  if (priv->volume_set)
-  {
-    pa_proplist_sets(proplist, "module-stream-restore.id",
-                     "x-maemo-hildon-notify");
+      /* let libsndfile decode anything PA can't take as it is */
+      if (!nsv_util_sf_format_to_pa(sfinfo.format, &spec.format))
+      {
+        spec.format = PA_SAMPLE_S16NE;
+        priv->convert = TRUE;
+      }
+
+      spec.channels = sfinfo.channels;
+      spec.rate = sfinfo.samplerate;
+
+      if (!pa_sample_spec_valid(&spec))
+        return FALSE;
+    }
   }
 
-  if (priv->event_id)
-    pa_proplist_sets(proplist, "event.id",  priv->event_id);
+  priv->spec = spec;
 
-  if (priv->media_role)
-    pa_proplist_sets(proplist, "media.role", priv->media_role);
+  if (_nsv_playback_stream_start_pooled(self))
+    goto refill;
+
+  _nsv_playback_get_buffer_attr(priv->latency, &spec, &attr);
 
-  priv->pa_stream = pa_stream_new_with_proplist(priv->pa_context, PACKAGE,
-                                                &spec, 0, proplist);
+  proplist = _nsv_playback_create_proplist(self);
+  priv->pa_stream =
+      pa_stream_new_with_proplist(
+        nsv_pulse_context_get_context(priv->pulse_context), PACKAGE, &spec, 0,
+        proplist);
   pa_proplist_free(proplist);
 
   if (!priv->pa_stream)
-    goto emit_error;
+    return FALSE;
 
   pa_stream_set_state_callback(priv->pa_stream,
                                _nsv_playback_stream_state_cb, self);
   pa_stream_set_write_callback(priv->pa_stream,
                                _nsv_playback_stream_write_cb, self);
+  pa_stream_set_started_callback(priv->pa_stream,
+                                 _nsv_playback_stream_started_cb, self);
+
+  if (pa_stream_connect_playback(priv->pa_stream, 0, &attr,
+                                 latency_profiles[priv->latency].flags,
+                                 0, 0) < 0)
+  {
+    return FALSE;
+  }
+
+refill:
+  /* have a corked stream ready for the next play of the same kind */
+  _nsv_playback_get_buffer_attr(priv->latency, &spec, &attr);
+  nsv_stream_pool_prepare(nsv_stream_pool_get_instance(), &spec,
+                          priv->media_role, _nsv_playback_get_restore_id(self),
+                          priv->latency, &attr,
+                          latency_profiles[priv->latency].flags);
+
+  return TRUE;
+}
+
+static void
+_nsv_playback_play_sample_cb(pa_context *c, uint32_t idx, void *userdata)
+{
+  NsvPlayback *self = NSV_PLAYBACK(userdata);
+  NsvPlaybackPrivate *priv = self->priv;
+
+  if (priv->sample_op)
+  {
+    pa_operation_unref(priv->sample_op);
+    priv->sample_op = NULL;
+  }
+
+  if (idx == PA_INVALID_INDEX)
+  {
+    /* the sample is gone from the server, stream the file instead */
+    nsv_sample_cache_remove(nsv_sample_cache_get_instance(), priv->filename);
+
+    if (!_nsv_playback_stream_start(self))
+    {
+      _nsv_playback_cleanup(self);
+      g_idle_add(_nsv_playback_emit_error_cb, self);
+    }
+
+    return;
+  }
+
+  /* the sample plays as soon as the sink input exists */
+  priv->stream_index = idx;
+  _nsv_playback_mark(self, NSV_PLAYBACK_STAGE_STREAM_READY);
+  _nsv_playback_mark(self, NSV_PLAYBACK_STAGE_FIRST_WRITE);
+  priv->sample_end_time = g_get_monotonic_time() + priv->sample_duration;
+  _nsv_playback_audio_started(self);
+}
+
+static gboolean
+_nsv_playback_sample_start(NsvPlayback *self)
+{
+  NsvPlaybackPrivate *priv = self->priv;
+  pa_proplist *proplist;
+  const char *name;
+
+  name = nsv_sample_cache_lookup(nsv_sample_cache_get_instance(),
+                                 priv->filename, &priv->sample_duration);
+
+  if (!name)
+    return FALSE;
+
+  proplist = _nsv_playback_create_proplist(self);
+  priv->sample_op = pa_context_play_sample_with_proplist(
+        nsv_pulse_context_get_context(priv->pulse_context), name, NULL,
+        PA_VOLUME_INVALID, proplist, _nsv_playback_play_sample_cb, self);
+  pa_proplist_free(proplist);
 
-  if (pa_stream_connect_playback(priv->pa_stream, 0, &attr, 0, 0, 0) < 0)
-    goto emit_error;
+  return priv->sample_op != NULL;
+}
 
-  g_timer_start(priv->timer);
+static void
+_nsv_playback_play_real(NsvPlayback *self)
+{
+  NsvPlaybackPrivate *priv = self->priv;
 
-  if (priv->max_timeout > 0)
+  if (!priv->filename)
+    return;
+
+  _nsv_playback_mark(self, NSV_PLAYBACK_STAGE_CONTEXT_READY);
+  priv->start_time = 0;
+  priv->drained = FALSE;
+  _nsv_playback_pa_set_volume(self, priv->volume);
+
+  if (priv->repeat || !_nsv_playback_sample_start(self))
   {
-    priv->max_timeout_id = g_timeout_add(priv->max_timeout,
-                                         _nsv_playback_emit_succeeded_cb, self);
+    if (!_nsv_playback_stream_start(self))
+      goto emit_error;
   }
 
+  _nsv_playback_schedule(self);
+
   if (priv->started)
   {
     g_signal_emit(self, started_id, 0);
@@ -704,15 +1386,16 @@ emit_error:
 }
 
 static void
-_nsv_playback_pa_context_state_cb(pa_context *c, void *userdata)
+_nsv_playback_pulse_context_ready_cb(NsvPulseContext *pulse_context,
+                                     gpointer user_data)
 {
-  NsvPlayback *self = NSV_PLAYBACK(userdata);
+  NsvPlayback *self = NSV_PLAYBACK(user_data);
   NsvPlaybackPrivate *priv = self->priv;
 
-  if (pa_context_get_state(c) == PA_CONTEXT_READY &&
-      priv->play_pending)
+  if (priv->play_pending)
   {
-      _nsv_playback_play_real(self);
+    priv->play_pending = FALSE;
+    _nsv_playback_play_real(self);
   }
 }
 
@@ -720,50 +1403,22 @@ static void
 nsv_playback_init(NsvPlayback *self)
 {
   NsvPlaybackPrivate *priv;
-  pa_proplist *proplist;
-  pa_mainloop_api *api;
 
   priv = g_new0(NsvPlaybackPrivate, 1);
   self->priv = priv;
   priv->handle = -1;
-  priv->timer = g_timer_new();
-
-  priv->pa_glib_mainloop = pa_glib_mainloop_new(g_main_context_default());
-
-  if (!priv->pa_glib_mainloop)
-    goto emit_error;
-
-  api = pa_glib_mainloop_get_api(priv->pa_glib_mainloop);
-
-  if (!api)
-    goto emit_error;
 
-  proplist = pa_proplist_new();
-  pa_proplist_sets(proplist, "application.name", PACKAGE);
-  pa_proplist_sets(proplist, "application.id", PACKAGE);
-  pa_proplist_sets(proplist, "application.version", PACKAGE_VERSION);
+  priv->pulse_context = nsv_pulse_context_get_instance();
 
-  priv->pa_context =
-      pa_context_new_with_proplist(api, PACKAGE, proplist);
-
-  pa_proplist_free(proplist);
-
-  if (!priv->pa_context)
-    goto emit_error;
-
-  pa_context_set_state_callback(priv->pa_context,
-                                _nsv_playback_pa_context_state_cb, self);
-
-  if (pa_context_connect(priv->pa_context, NULL,
-                         PA_CONTEXT_NOFAIL|PA_CONTEXT_NOAUTOSPAWN, 0) < 0)
+  if (!priv->pulse_context)
   {
-    goto emit_error;
+    g_signal_emit(self, error_id, 0);
+    return;
   }
 
-  return;
-
-emit_error:
-    g_signal_emit(self, error_id, 0);
+  g_object_ref(priv->pulse_context);
+  g_signal_connect(G_OBJECT(priv->pulse_context), "ready",
+                   G_CALLBACK(_nsv_playback_pulse_context_ready_cb), self);
 }
 
 NsvPlayback *
@@ -779,10 +1434,12 @@ nsv_playback_play(NsvPlayback *self)
 
   priv->started = TRUE;
   priv->stopped = FALSE;
+  memset(priv->stage_time, 0, sizeof(priv->stage_time));
+  _nsv_playback_mark(self, NSV_PLAYBACK_STAGE_PLAY);
 
-  if (priv->pa_context &&
-      pa_context_get_state(priv->pa_context) == PA_CONTEXT_READY)
+  if (priv->pulse_context && nsv_pulse_context_is_ready(priv->pulse_context))
   {
+    priv->play_pending = FALSE;
     _nsv_playback_play_real(self);
   }
   else
@@ -796,12 +1453,100 @@ nsv_playback_stop(NsvPlayback *self)
 {
   NsvPlaybackPrivate *priv = self->priv;
 
-  if (!priv->pa_context)
+  if (!priv->pulse_context)
     return FALSE;
 
   priv->stopped = TRUE;
+  priv->play_pending = FALSE;
   _nsv_playback_cleanup(self);
   g_signal_emit(self, stopped_id, 0);
 
   return TRUE;
 }
+
+static gboolean
+_nsv_playback_get_file_spec(const char *filename, pa_sample_spec *spec)
+{
+  guint8 header[NSV_PLAYBACK_HEADER_SIZE];
+  struct nsv_wav_info info;
+  SF_INFO sfinfo;
+  SNDFILE *sndfile;
+  size_t length;
+  FILE *fp;
+
+  /* the same spec _nsv_playback_stream_start() ends up with */
+  if (g_str_has_suffix(filename, ".decoded"))
+  {
+    spec->format = PA_SAMPLE_ALAW;
+    spec->channels = 1;
+    spec->rate = 48000;
+
+    return TRUE;
+  }
+
+  if ((fp = fopen(filename, "rb")))
+  {
+    length = fread(header, 1, sizeof(header), fp);
+    fclose(fp);
+
+    if (nsv_util_wav_parse(header, length, &info))
+    {
+      *spec = info.spec;
+      return TRUE;
+    }
+  }
+
+  memset(&sfinfo, 0, sizeof(sfinfo));
+  sndfile = sf_open(filename, SFM_READ, &sfinfo);
+
+  if (!sndfile)
+    return FALSE;
+
+  if (!nsv_util_sf_format_to_pa(sfinfo.format, &spec->format))
+    spec->format = PA_SAMPLE_S16NE;
+
+  spec->channels = sfinfo.channels;
+  spec->rate = sfinfo.samplerate;
+  sf_close(sndfile);
+
+  return pa_sample_spec_valid(spec);
+}
+
+void
+nsv_playback_preconnect(const char *filename, const char *media_role,
+                        NsvPlaybackLatency latency)
+{
+  pa_sample_spec spec;
+  pa_buffer_attr attr;
+
+  if (!filename || !_nsv_playback_get_file_spec(filename, &spec))
+    return;
+
+  /* every event sets a volume, so every stream carries the restore id */
+  _nsv_playback_get_buffer_attr(latency, &spec, &attr);
+  nsv_stream_pool_prepare(nsv_stream_pool_get_instance(), &spec, media_role,
+                          NSV_PLAYBACK_RESTORE_ID, latency, &attr,
+                          latency_profiles[latency].flags);
+}
+
+gint64
+nsv_playback_get_stage_time(NsvPlayback *self, NsvPlaybackStage stage)
+{
+  g_return_val_if_fail(stage < NSV_PLAYBACK_STAGE_LAST, 0);
+
+  return self->priv->stage_time[stage];
+}
+
+const guint *
+nsv_playback_get_histogram(NsvPlaybackStage stage)
+{
+  g_return_val_if_fail(stage < NSV_PLAYBACK_STAGE_LAST, NULL);
+
+  return histograms[stage];
+}
+
+void
+nsv_playback_reset_histograms()
+{
+  memset(histograms, 0, sizeof(histograms));
+}
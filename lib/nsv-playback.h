@@ -3,9 +3,36 @@
 
 typedef struct _NsvPlayback NsvPlayback;
 
+typedef enum
+{
+  NSV_PLAYBACK_LATENCY_NORMAL = 0,
+  NSV_PLAYBACK_LATENCY_LOW,
+  NSV_PLAYBACK_LATENCY_POWER_SAVING
+} NsvPlaybackLatency;
+
+typedef enum
+{
+  NSV_PLAYBACK_STAGE_PLAY = 0,
+  NSV_PLAYBACK_STAGE_CONTEXT_READY,
+  NSV_PLAYBACK_STAGE_STREAM_READY,
+  NSV_PLAYBACK_STAGE_FIRST_WRITE,
+  NSV_PLAYBACK_STAGE_STARTED,
+  NSV_PLAYBACK_STAGE_DRAINED,
+  NSV_PLAYBACK_STAGE_LAST
+} NsvPlaybackStage;
+
+#define NSV_PLAYBACK_HISTOGRAM_SIZE 32
+
 NsvPlayback *nsv_playback_new();
 
 gboolean nsv_playback_play(NsvPlayback *self);
 gboolean nsv_playback_stop(NsvPlayback *self);
 
+void nsv_playback_preconnect(const char *filename, const char *media_role,
+                             NsvPlaybackLatency latency);
+
+gint64 nsv_playback_get_stage_time(NsvPlayback *self, NsvPlaybackStage stage);
+const guint *nsv_playback_get_histogram(NsvPlaybackStage stage);
+void nsv_playback_reset_histograms();
+
 #endif // NSV_PLAYBACK_H
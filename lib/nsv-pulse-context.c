@@ -36,6 +36,8 @@ struct _NsvPulseContextPrivate
   pa_context *pa_context;
   pa_ext_stream_restore_info stream_restore;
   gboolean stream_restore_write_pending;
+  pa_sample_spec sink_spec;
+  gboolean sink_spec_valid;
 };
 
 G_DEFINE_TYPE(NsvPulseContext, nsv_pulse_context, G_TYPE_OBJECT);
@@ -47,6 +49,7 @@ static guint ready_id;
 static guint terminated_id;
 static guint failed_id;
 static guint error_id;
+static guint sink_changed_id;
 
 static gboolean nsv_pulse_context_reinitialize(gpointer user_data);
 static void nsv_pulse_context_terminate(NsvPulseContext *self);
@@ -128,6 +131,12 @@ nsv_pulse_context_class_init(NsvPulseContextClass *klass)
                           0, NULL, NULL,
                           &g_cclosure_marshal_VOID__VOID,
                           G_TYPE_NONE, 0, G_TYPE_NONE);
+
+  sink_changed_id = g_signal_new("sink-changed",
+                                 G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+                                 0, NULL, NULL,
+                                 &g_cclosure_marshal_VOID__VOID,
+                                 G_TYPE_NONE, 0, G_TYPE_NONE);
 }
 
 static void
@@ -143,11 +152,74 @@ nsv_pulse_context_pa_ext_stream_restore_write(
     pa_operation_unref(pa_op);
 }
 
+static void
+_nsv_pulse_context_sink_info_cb(pa_context *c, const pa_sink_info *i, int eol,
+                                void *userdata)
+{
+  NsvPulseContext *self = NSV_PULSE_CONTEXT(userdata);
+  NsvPulseContextPrivate *priv = self->priv;
+
+  if (eol || !i)
+    return;
+
+  if (priv->sink_spec_valid && pa_sample_spec_equal(&priv->sink_spec,
+                                                    &i->sample_spec))
+  {
+    return;
+  }
+
+  g_debug("Default sink %s runs at %u Hz, %u channels", i->name,
+          i->sample_spec.rate, i->sample_spec.channels);
+
+  priv->sink_spec = i->sample_spec;
+  priv->sink_spec_valid = TRUE;
+  g_signal_emit(self, sink_changed_id, 0);
+}
+
+static void
+_nsv_pulse_context_server_info_cb(pa_context *c, const pa_server_info *i,
+                                  void *userdata)
+{
+  pa_operation *pa_op;
+
+  if (!i || !i->default_sink_name)
+    return;
+
+  pa_op = pa_context_get_sink_info_by_name(c, i->default_sink_name,
+                                           _nsv_pulse_context_sink_info_cb,
+                                           userdata);
+
+  if (pa_op)
+    pa_operation_unref(pa_op);
+}
+
+static void
+nsv_pulse_context_query_sink(NsvPulseContext *self)
+{
+  pa_operation *pa_op =
+      pa_context_get_server_info(self->priv->pa_context,
+                                 _nsv_pulse_context_server_info_cb, self);
+
+  if (pa_op)
+    pa_operation_unref(pa_op);
+}
+
+static void
+_nsv_pulse_context_subscribe_cb(pa_context *c,
+                                pa_subscription_event_type_t t, uint32_t idx,
+                                void *userdata)
+{
+  /* default sink switched or got reconfigured */
+  if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_CHANGE)
+    nsv_pulse_context_query_sink(NSV_PULSE_CONTEXT(userdata));
+}
+
 static void
 _nsv_pulse_context_pa_context_state_cb(pa_context *c, void *userdata)
 {
   NsvPulseContext *self = NSV_PULSE_CONTEXT(userdata);
   NsvPulseContextPrivate *priv = self->priv;
+  pa_operation *pa_op;
 
   switch (pa_context_get_state(c))
   {
@@ -160,6 +232,18 @@ _nsv_pulse_context_pa_context_state_cb(pa_context *c, void *userdata)
                                                       &priv->stream_restore);
       }
 
+      pa_context_set_subscribe_callback(c, _nsv_pulse_context_subscribe_cb,
+                                        self);
+      pa_op = pa_context_subscribe(c,
+                                   PA_SUBSCRIPTION_MASK_SERVER |
+                                   PA_SUBSCRIPTION_MASK_SINK,
+                                   NULL, NULL);
+
+      if (pa_op)
+        pa_operation_unref(pa_op);
+
+      nsv_pulse_context_query_sink(self);
+
       g_signal_emit(self, ready_id, 0);
       break;
     }
@@ -234,9 +318,12 @@ nsv_pulse_context_terminate(NsvPulseContext *self)
 {
   NsvPulseContextPrivate *priv = self->priv;
 
+  priv->sink_spec_valid = FALSE;
+
   if (priv->pa_context)
   {
     pa_context_set_state_callback(priv->pa_context, NULL, NULL);
+    pa_context_set_subscribe_callback(priv->pa_context, NULL, NULL);
     pa_context_disconnect(priv->pa_context);
     pa_context_unref(priv->pa_context);
     priv->pa_context = NULL;
@@ -306,6 +393,19 @@ nsv_pulse_context_set_rule_volume(NsvPulseContext *self, const char *rule,
     priv->stream_restore_write_pending = TRUE;
 }
 
+gboolean
+nsv_pulse_context_get_sink_spec(NsvPulseContext *self, pa_sample_spec *spec)
+{
+  NsvPulseContextPrivate *priv = self->priv;
+
+  if (!priv->sink_spec_valid)
+    return FALSE;
+
+  *spec = priv->sink_spec;
+
+  return TRUE;
+}
+
 pa_context *
 nsv_pulse_context_get_context(NsvPulseContext *self)
 {
@@ -5,6 +5,7 @@ typedef struct _NsvPulseContext NsvPulseContext;
 
 gboolean nsv_pulse_context_is_ready(NsvPulseContext *self);
 void nsv_pulse_context_set_rule_volume(NsvPulseContext *self, const char *rule, int volume);
+gboolean nsv_pulse_context_get_sink_spec(NsvPulseContext *self, pa_sample_spec *spec);
 pa_context *nsv_pulse_context_get_context(NsvPulseContext *self);
 NsvPulseContext *nsv_pulse_context_get_instance();
 
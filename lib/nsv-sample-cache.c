@@ -0,0 +1,498 @@
+#include <glib-object.h>
+#include <pulse/pulseaudio.h>
+#include <sndfile.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+#include "nsv-sample-cache.h"
+#include "nsv-buffer-arena.h"
+#include "nsv-pulse-context.h"
+#include "nsv-util.h"
+
+#define NSV_TYPE_SAMPLE_CACHE (nsv_sample_cache_get_type ())
+#define NSV_SAMPLE_CACHE(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+                                         NSV_TYPE_SAMPLE_CACHE, NsvSampleCache))
+
+/* samples bigger than this are streamed, PA keeps the cache in memory */
+#define NSV_SAMPLE_CACHE_MAX_SIZE (1024 * 1024)
+
+/* scratch space for the upload, PA copies what is written */
+#define NSV_SAMPLE_UPLOAD_CHUNK (64 * 1024)
+
+typedef struct _NsvSampleCacheClass NsvSampleCacheClass;
+typedef struct _NsvSampleCachePrivate NsvSampleCachePrivate;
+
+struct _NsvSampleCacheClass {
+  GObjectClass parent_class;
+};
+
+struct _NsvSampleCache
+{
+  GObject parent_instance;
+  NsvSampleCachePrivate *priv;
+};
+
+struct _NsvSampleCachePrivate
+{
+  NsvPulseContext *pulse_context;
+  GHashTable *samples;
+};
+
+struct nsv_sample
+{
+  NsvSampleCache *cache;
+  gchar *filename;
+  /* what the file looked like when it was uploaded */
+  gint64 mtime;
+  gint64 size;
+  gchar *name;
+  gboolean ready;
+  gboolean uploaded;
+  guint drop_id;
+  pa_usec_t duration;
+  pa_stream *stream;
+  size_t length;
+  size_t written;
+  /* libsndfile decodes it to S16NE, in whole frames */
+  gboolean convert;
+  size_t frame_size;
+  gpointer buffer;
+  gsize buffer_size;
+  int handle;
+  SNDFILE *sndfile;
+  FILE *fp;
+};
+
+G_DEFINE_TYPE(NsvSampleCache, nsv_sample_cache, G_TYPE_OBJECT);
+
+static GObjectClass *parent_class = NULL;
+
+static void
+_nsv_sample_close_file(struct nsv_sample *sample)
+{
+  if (sample->fp)
+  {
+    fclose(sample->fp);
+    sample->fp = NULL;
+  }
+
+  if (sample->sndfile)
+  {
+    sf_close(sample->sndfile);
+    sample->sndfile = NULL;
+  }
+
+  if (sample->handle != -1)
+  {
+    close(sample->handle);
+    sample->handle = -1;
+  }
+
+  if (sample->buffer)
+  {
+    nsv_buffer_arena_free(sample->buffer, sample->buffer_size);
+    sample->buffer = NULL;
+  }
+}
+
+static void
+_nsv_sample_free(gpointer data)
+{
+  struct nsv_sample *sample = (struct nsv_sample *)data;
+
+  if (sample->drop_id)
+  {
+    g_source_remove(sample->drop_id);
+    sample->drop_id = 0;
+  }
+
+  if (sample->stream)
+  {
+    pa_stream_set_state_callback(sample->stream, NULL, NULL);
+    pa_stream_set_write_callback(sample->stream, NULL, NULL);
+    pa_stream_disconnect(sample->stream);
+    pa_stream_unref(sample->stream);
+    sample->stream = NULL;
+  }
+
+  _nsv_sample_close_file(sample);
+  g_free(sample->filename);
+  g_free(sample->name);
+  g_slice_free(struct nsv_sample, sample);
+}
+
+static void
+nsv_sample_cache_finalize(GObject *object)
+{
+  NsvSampleCache *self = NSV_SAMPLE_CACHE(object);
+  NsvSampleCachePrivate *priv = self->priv;
+
+  if (priv->samples)
+  {
+    g_hash_table_destroy(priv->samples);
+    priv->samples = NULL;
+  }
+
+  if (priv->pulse_context)
+  {
+    g_signal_handlers_disconnect_matched(priv->pulse_context,
+                                         G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL,
+                                         self);
+    g_object_unref(priv->pulse_context);
+    priv->pulse_context = NULL;
+  }
+
+  g_free(self->priv);
+  self->priv = NULL;
+
+  G_OBJECT_CLASS(parent_class)->finalize(object);
+}
+
+static void
+nsv_sample_cache_class_init(NsvSampleCacheClass *klass)
+{
+  parent_class = g_type_class_peek_parent(klass);
+  G_OBJECT_CLASS(klass)->finalize = nsv_sample_cache_finalize;
+}
+
+static void
+_nsv_sample_cache_pulse_context_failed_cb(NsvPulseContext *pulse_context,
+                                          gpointer user_data)
+{
+  NsvSampleCache *self = NSV_SAMPLE_CACHE(user_data);
+
+  /* the server might be gone together with its sample cache */
+  g_hash_table_remove_all(self->priv->samples);
+}
+
+static void
+nsv_sample_cache_init(NsvSampleCache *self)
+{
+  NsvSampleCachePrivate *priv = g_new0(NsvSampleCachePrivate, 1);
+
+  self->priv = priv;
+  priv->samples = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                        _nsv_sample_free);
+  priv->pulse_context = g_object_ref(nsv_pulse_context_get_instance());
+  g_signal_connect(G_OBJECT(priv->pulse_context), "failed",
+                   G_CALLBACK(_nsv_sample_cache_pulse_context_failed_cb),
+                   self);
+  g_signal_connect(G_OBJECT(priv->pulse_context), "terminated",
+                   G_CALLBACK(_nsv_sample_cache_pulse_context_failed_cb),
+                   self);
+}
+
+static gboolean
+_nsv_sample_cache_drop_cb(gpointer user_data)
+{
+  struct nsv_sample *sample = (struct nsv_sample *)user_data;
+  NsvSampleCachePrivate *priv = sample->cache->priv;
+
+  sample->drop_id = 0;
+  g_hash_table_remove(priv->samples, sample->filename);
+
+  return FALSE;
+}
+
+static void
+_nsv_sample_upload_state_cb(pa_stream *p, void *userdata)
+{
+  struct nsv_sample *sample = (struct nsv_sample *)userdata;
+
+  switch (pa_stream_get_state(p))
+  {
+    case PA_STREAM_TERMINATED:
+    {
+      if (sample->uploaded)
+      {
+        g_debug("Sample '%s' uploaded as '%s'", sample->filename,
+                sample->name);
+        pa_stream_set_state_callback(sample->stream, NULL, NULL);
+        pa_stream_unref(sample->stream);
+        sample->stream = NULL;
+        sample->ready = TRUE;
+        break;
+      }
+    } /* fallthrough */
+    case PA_STREAM_FAILED:
+    {
+      g_warning("Failed to upload sample '%s'", sample->filename);
+      pa_stream_set_state_callback(p, NULL, NULL);
+      pa_stream_set_write_callback(p, NULL, NULL);
+
+      if (!sample->drop_id)
+        sample->drop_id = g_idle_add(_nsv_sample_cache_drop_cb, sample);
+
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+static void
+_nsv_sample_upload_write_cb(pa_stream *p, size_t nbytes, void *userdata)
+{
+  struct nsv_sample *sample = (struct nsv_sample *)userdata;
+
+  if (!sample->buffer)
+  {
+    sample->buffer = nsv_buffer_arena_alloc(NSV_SAMPLE_UPLOAD_CHUNK,
+                                            &sample->buffer_size);
+  }
+
+  while (nbytes && sample->written < sample->length)
+  {
+    size_t bytes = MIN(MIN(nbytes, sample->buffer_size),
+                       sample->length - sample->written);
+    size_t len;
+
+    /* not even a frame asked for, wait for the next request */
+    if (sample->convert && bytes < sample->frame_size)
+      break;
+
+    if (sample->fp)
+      len = fread(sample->buffer, 1, bytes, sample->fp);
+    else if (sample->convert)
+    {
+      len = sf_readf_short(sample->sndfile, (short *)sample->buffer,
+                           bytes / sample->frame_size) * sample->frame_size;
+    }
+    else
+      len = sf_read_raw(sample->sndfile, sample->buffer, bytes);
+
+    if (!len)
+      goto error;
+
+    if (pa_stream_write(p, sample->buffer, len, NULL, 0,
+                        PA_SEEK_RELATIVE) < 0)
+    {
+      goto error;
+    }
+
+    sample->written += len;
+    nbytes -= MIN(nbytes, len);
+  }
+
+  if (sample->written >= sample->length)
+  {
+    _nsv_sample_close_file(sample);
+    pa_stream_set_write_callback(p, NULL, NULL);
+    sample->uploaded = TRUE;
+    pa_stream_finish_upload(p);
+  }
+
+  return;
+
+error:
+  g_warning("Failed to read sample '%s'", sample->filename);
+  pa_stream_set_write_callback(p, NULL, NULL);
+  pa_stream_disconnect(p);
+}
+
+static gboolean
+_nsv_sample_open(struct nsv_sample *sample, pa_sample_spec *spec)
+{
+  struct stat st;
+
+  if (stat(sample->filename, &st) == -1)
+    return FALSE;
+
+  sample->mtime = st.st_mtime;
+  sample->size = st.st_size;
+
+  if (g_str_has_suffix(sample->filename, ".decoded"))
+  {
+    if (!(sample->fp = fopen(sample->filename, "rb")))
+      return FALSE;
+
+    spec->format = PA_SAMPLE_ALAW;
+    spec->channels = 1;
+    spec->rate = 48000;
+    sample->length = st.st_size;
+  }
+  else
+  {
+    SF_INFO sfinfo;
+
+    sample->handle = open(sample->filename, O_RDONLY);
+
+    if (sample->handle == -1)
+      return FALSE;
+
+    sample->sndfile = sf_open_fd(sample->handle, SFM_READ, &sfinfo, 0);
+
+    if (!sample->sndfile)
+      return FALSE;
+
+    /* let libsndfile decode anything PA can't take as it is */
+    if (!nsv_util_sf_format_to_pa(sfinfo.format, &spec->format))
+    {
+      spec->format = PA_SAMPLE_S16NE;
+      sample->convert = TRUE;
+    }
+
+    spec->channels = sfinfo.channels;
+    spec->rate = sfinfo.samplerate;
+
+    if (!pa_sample_spec_valid(spec))
+      return FALSE;
+
+    sample->frame_size = pa_frame_size(spec);
+    sample->length = sfinfo.frames * sample->frame_size;
+  }
+
+  if (!sample->length || sample->length > NSV_SAMPLE_CACHE_MAX_SIZE)
+    return FALSE;
+
+  sample->length -= sample->length % pa_frame_size(spec);
+  sample->duration = pa_bytes_to_usec(sample->length, spec);
+
+  return TRUE;
+}
+
+/* a file overwritten in place must not keep playing the old audio */
+static gboolean
+_nsv_sample_is_stale(struct nsv_sample *sample)
+{
+  struct stat st;
+
+  if (stat(sample->filename, &st) == -1)
+    return TRUE;
+
+  return sample->mtime != st.st_mtime || sample->size != st.st_size;
+}
+
+void
+nsv_sample_cache_preload(NsvSampleCache *self, const char *filename)
+{
+  NsvSampleCachePrivate *priv = self->priv;
+  struct nsv_sample *sample;
+  pa_sample_spec spec;
+  pa_context *context;
+  gchar *key;
+
+  if (!filename)
+    return;
+
+  sample = (struct nsv_sample *)g_hash_table_lookup(priv->samples, filename);
+
+  if (sample)
+  {
+    if (!_nsv_sample_is_stale(sample))
+      return;
+
+    nsv_sample_cache_remove(self, filename);
+  }
+
+  if (!nsv_pulse_context_is_ready(priv->pulse_context))
+    return;
+
+  context = nsv_pulse_context_get_context(priv->pulse_context);
+
+  sample = g_slice_new0(struct nsv_sample);
+  sample->cache = self;
+  sample->handle = -1;
+  sample->filename = g_strdup(filename);
+
+  if (!_nsv_sample_open(sample, &spec))
+  {
+    _nsv_sample_free(sample);
+    return;
+  }
+
+  /* a new upload of a changed file doesn't replace the one still playing */
+  key = g_strdup_printf("%s\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT,
+                        filename, sample->mtime, sample->size);
+  sample->name = g_compute_checksum_for_string(G_CHECKSUM_MD5, key, -1);
+  g_free(key);
+  sample->stream = pa_stream_new(context, sample->name, &spec, NULL);
+
+  if (!sample->stream)
+  {
+    _nsv_sample_free(sample);
+    return;
+  }
+
+  pa_stream_set_state_callback(sample->stream,
+                               _nsv_sample_upload_state_cb, sample);
+  pa_stream_set_write_callback(sample->stream,
+                               _nsv_sample_upload_write_cb, sample);
+
+  if (pa_stream_connect_upload(sample->stream, sample->length) < 0)
+  {
+    _nsv_sample_free(sample);
+    return;
+  }
+
+  g_hash_table_insert(priv->samples, sample->filename, sample);
+}
+
+void
+nsv_sample_cache_remove(NsvSampleCache *self, const char *filename)
+{
+  NsvSampleCachePrivate *priv = self->priv;
+  struct nsv_sample *sample;
+
+  if (!filename)
+    return;
+
+  sample = (struct nsv_sample *)g_hash_table_lookup(priv->samples, filename);
+
+  if (!sample)
+    return;
+
+  if (sample->ready && nsv_pulse_context_is_ready(priv->pulse_context))
+  {
+    pa_operation *op = pa_context_remove_sample(
+          nsv_pulse_context_get_context(priv->pulse_context), sample->name,
+          NULL, NULL);
+
+    if (op)
+      pa_operation_unref(op);
+  }
+
+  g_hash_table_remove(priv->samples, filename);
+}
+
+const char *
+nsv_sample_cache_lookup(NsvSampleCache *self, const char *filename,
+                        pa_usec_t *duration)
+{
+  struct nsv_sample *sample;
+
+  if (!filename)
+    return NULL;
+
+  sample = (struct nsv_sample *)g_hash_table_lookup(self->priv->samples,
+                                                    filename);
+
+  if (!sample || !sample->ready)
+    return NULL;
+
+  if (_nsv_sample_is_stale(sample))
+  {
+    nsv_sample_cache_remove(self, filename);
+    return NULL;
+  }
+
+  if (duration)
+    *duration = sample->duration;
+
+  return sample->name;
+}
+
+NsvSampleCache *
+nsv_sample_cache_get_instance()
+{
+  static NsvSampleCache *instance = NULL;
+
+  if (!instance)
+    instance = NSV_SAMPLE_CACHE(g_object_new(NSV_TYPE_SAMPLE_CACHE, NULL));
+
+  return instance;
+}
@@ -0,0 +1,13 @@
+#ifndef NSV_SAMPLE_CACHE_H
+#define NSV_SAMPLE_CACHE_H
+
+typedef struct _NsvSampleCache NsvSampleCache;
+
+NsvSampleCache *nsv_sample_cache_get_instance();
+
+void nsv_sample_cache_preload(NsvSampleCache *self, const char *filename);
+void nsv_sample_cache_remove(NsvSampleCache *self, const char *filename);
+const char *nsv_sample_cache_lookup(NsvSampleCache *self, const char *filename,
+                                    pa_usec_t *duration);
+
+#endif // NSV_SAMPLE_CACHE_H
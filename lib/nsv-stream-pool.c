@@ -0,0 +1,260 @@
+#include <glib-object.h>
+#include <pulse/pulseaudio.h>
+
+#include "config.h"
+
+#include "nsv-stream-pool.h"
+#include "nsv-pulse-context.h"
+
+#define NSV_TYPE_STREAM_POOL (nsv_stream_pool_get_type ())
+#define NSV_STREAM_POOL(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+                                         NSV_TYPE_STREAM_POOL, NsvStreamPool))
+
+typedef struct _NsvStreamPoolClass NsvStreamPoolClass;
+typedef struct _NsvStreamPoolPrivate NsvStreamPoolPrivate;
+
+struct _NsvStreamPoolClass {
+  GObjectClass parent_class;
+};
+
+struct _NsvStreamPool
+{
+  GObject parent_instance;
+  NsvStreamPoolPrivate *priv;
+};
+
+struct _NsvStreamPoolPrivate
+{
+  NsvPulseContext *pulse_context;
+  GHashTable *streams;
+};
+
+/* one corked stream is kept connected per key */
+struct nsv_pooled_stream
+{
+  NsvStreamPool *pool;
+  gchar *key;
+  pa_stream *stream;
+  guint drop_id;
+};
+
+G_DEFINE_TYPE(NsvStreamPool, nsv_stream_pool, G_TYPE_OBJECT);
+
+static GObjectClass *parent_class = NULL;
+
+static void
+_nsv_pooled_stream_free(gpointer data)
+{
+  struct nsv_pooled_stream *entry = (struct nsv_pooled_stream *)data;
+
+  if (entry->drop_id)
+  {
+    g_source_remove(entry->drop_id);
+    entry->drop_id = 0;
+  }
+
+  if (entry->stream)
+  {
+    pa_stream_set_state_callback(entry->stream, NULL, NULL);
+    pa_stream_disconnect(entry->stream);
+    pa_stream_unref(entry->stream);
+    entry->stream = NULL;
+  }
+
+  g_free(entry->key);
+  g_slice_free(struct nsv_pooled_stream, entry);
+}
+
+static void
+nsv_stream_pool_finalize(GObject *object)
+{
+  NsvStreamPool *self = NSV_STREAM_POOL(object);
+  NsvStreamPoolPrivate *priv = self->priv;
+
+  if (priv->streams)
+  {
+    g_hash_table_destroy(priv->streams);
+    priv->streams = NULL;
+  }
+
+  if (priv->pulse_context)
+  {
+    g_signal_handlers_disconnect_matched(priv->pulse_context,
+                                         G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL,
+                                         self);
+    g_object_unref(priv->pulse_context);
+    priv->pulse_context = NULL;
+  }
+
+  g_free(self->priv);
+  self->priv = NULL;
+
+  G_OBJECT_CLASS(parent_class)->finalize(object);
+}
+
+static void
+nsv_stream_pool_class_init(NsvStreamPoolClass *klass)
+{
+  parent_class = g_type_class_peek_parent(klass);
+  G_OBJECT_CLASS(klass)->finalize = nsv_stream_pool_finalize;
+}
+
+static void
+_nsv_stream_pool_pulse_context_failed_cb(NsvPulseContext *pulse_context,
+                                         gpointer user_data)
+{
+  NsvStreamPool *self = NSV_STREAM_POOL(user_data);
+
+  g_hash_table_remove_all(self->priv->streams);
+}
+
+static void
+nsv_stream_pool_init(NsvStreamPool *self)
+{
+  NsvStreamPoolPrivate *priv = g_new0(NsvStreamPoolPrivate, 1);
+
+  self->priv = priv;
+  priv->streams = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                        _nsv_pooled_stream_free);
+  priv->pulse_context = g_object_ref(nsv_pulse_context_get_instance());
+  g_signal_connect(G_OBJECT(priv->pulse_context), "failed",
+                   G_CALLBACK(_nsv_stream_pool_pulse_context_failed_cb),
+                   self);
+  g_signal_connect(G_OBJECT(priv->pulse_context), "terminated",
+                   G_CALLBACK(_nsv_stream_pool_pulse_context_failed_cb),
+                   self);
+}
+
+/* stream-restore looks at the id only once, when the stream is created */
+static gchar *
+_nsv_stream_pool_key(const pa_sample_spec *spec, const char *media_role,
+                     const char *restore_id, int latency)
+{
+  return g_strdup_printf("%d:%u:%u:%d:%s:%s", spec->format, spec->rate,
+                         spec->channels, latency,
+                         media_role ? media_role : "",
+                         restore_id ? restore_id : "");
+}
+
+static gboolean
+_nsv_stream_pool_drop_cb(gpointer user_data)
+{
+  struct nsv_pooled_stream *entry = (struct nsv_pooled_stream *)user_data;
+
+  entry->drop_id = 0;
+  g_hash_table_remove(entry->pool->priv->streams, entry->key);
+
+  return FALSE;
+}
+
+static void
+_nsv_pooled_stream_state_cb(pa_stream *p, void *userdata)
+{
+  struct nsv_pooled_stream *entry = (struct nsv_pooled_stream *)userdata;
+  pa_stream_state_t state = pa_stream_get_state(p);
+
+  if (state == PA_STREAM_FAILED || state == PA_STREAM_TERMINATED)
+  {
+    pa_stream_set_state_callback(p, NULL, NULL);
+
+    if (!entry->drop_id)
+      entry->drop_id = g_idle_add(_nsv_stream_pool_drop_cb, entry);
+  }
+}
+
+void
+nsv_stream_pool_prepare(NsvStreamPool *self, const pa_sample_spec *spec,
+                        const char *media_role, const char *restore_id,
+                        int latency, const pa_buffer_attr *attr,
+                        pa_stream_flags_t flags)
+{
+  NsvStreamPoolPrivate *priv = self->priv;
+  struct nsv_pooled_stream *entry;
+  pa_proplist *proplist;
+  gchar *key;
+
+  if (!nsv_pulse_context_is_ready(priv->pulse_context))
+    return;
+
+  key = _nsv_stream_pool_key(spec, media_role, restore_id, latency);
+
+  if (g_hash_table_lookup(priv->streams, key))
+  {
+    g_free(key);
+    return;
+  }
+
+  /* stream-restore picks the volume when the sink input is created */
+  proplist = pa_proplist_new();
+
+  if (restore_id)
+    pa_proplist_sets(proplist, "module-stream-restore.id", restore_id);
+
+  if (media_role)
+    pa_proplist_sets(proplist, "media.role", media_role);
+
+  entry = g_slice_new0(struct nsv_pooled_stream);
+  entry->pool = self;
+  entry->key = key;
+  entry->stream = pa_stream_new_with_proplist(
+        nsv_pulse_context_get_context(priv->pulse_context), PACKAGE, spec,
+        NULL, proplist);
+  pa_proplist_free(proplist);
+
+  if (!entry->stream)
+    goto error;
+
+  pa_stream_set_state_callback(entry->stream, _nsv_pooled_stream_state_cb,
+                               entry);
+
+  if (pa_stream_connect_playback(entry->stream, NULL, attr,
+                                 flags | PA_STREAM_START_CORKED,
+                                 NULL, NULL) < 0)
+  {
+    goto error;
+  }
+
+  g_hash_table_insert(priv->streams, entry->key, entry);
+
+  return;
+
+error:
+  _nsv_pooled_stream_free(entry);
+}
+
+pa_stream *
+nsv_stream_pool_acquire(NsvStreamPool *self, const pa_sample_spec *spec,
+                        const char *media_role, const char *restore_id,
+                        int latency)
+{
+  NsvStreamPoolPrivate *priv = self->priv;
+  struct nsv_pooled_stream *entry;
+  pa_stream *stream = NULL;
+  gchar *key;
+
+  key = _nsv_stream_pool_key(spec, media_role, restore_id, latency);
+  entry = (struct nsv_pooled_stream *)g_hash_table_lookup(priv->streams, key);
+
+  if (entry && pa_stream_get_state(entry->stream) == PA_STREAM_READY)
+  {
+    stream = entry->stream;
+    pa_stream_set_state_callback(stream, NULL, NULL);
+    entry->stream = NULL;
+    g_hash_table_remove(priv->streams, key);
+  }
+
+  g_free(key);
+
+  return stream;
+}
+
+NsvStreamPool *
+nsv_stream_pool_get_instance()
+{
+  static NsvStreamPool *instance = NULL;
+
+  if (!instance)
+    instance = NSV_STREAM_POOL(g_object_new(NSV_TYPE_STREAM_POOL, NULL));
+
+  return instance;
+}
@@ -0,0 +1,17 @@
+#ifndef NSV_STREAM_POOL_H
+#define NSV_STREAM_POOL_H
+
+typedef struct _NsvStreamPool NsvStreamPool;
+
+NsvStreamPool *nsv_stream_pool_get_instance();
+
+void nsv_stream_pool_prepare(NsvStreamPool *self, const pa_sample_spec *spec,
+                             const char *media_role, const char *restore_id,
+                             int latency, const pa_buffer_attr *attr,
+                             pa_stream_flags_t flags);
+pa_stream *nsv_stream_pool_acquire(NsvStreamPool *self,
+                                   const pa_sample_spec *spec,
+                                   const char *media_role,
+                                   const char *restore_id, int latency);
+
+#endif // NSV_STREAM_POOL_H
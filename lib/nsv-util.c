@@ -229,6 +229,33 @@ nsv_util_valid_sound_file(const char *file)
   return rv;
 }
 
+gboolean
+nsv_util_readable_sound_file(const char *file, gint max_length)
+{
+  SNDFILE *sndfile;
+  SF_INFO sfinfo;
+  gboolean rv;
+
+  if (!file)
+    return FALSE;
+
+  memset(&sfinfo, 0, sizeof(sfinfo));
+  sndfile = sf_open(file, SFM_READ, &sfinfo);
+
+  if (!sndfile)
+    return FALSE;
+
+  rv = sfinfo.frames > 0 && sfinfo.channels > 0 && sfinfo.samplerate > 0;
+
+  /* in milliseconds, no limit if it is 0 */
+  if (rv && max_length > 0)
+    rv = sfinfo.frames <= (sf_count_t)sfinfo.samplerate * max_length / 1000;
+
+  sf_close(sndfile);
+
+  return rv;
+}
+
 gboolean
 nsv_util_valid_rootfs_sound_file(const char *file)
 {
@@ -253,3 +280,198 @@ nsv_util_valid_rootfs_sound_file(const char *file)
 
   return rv;
 }
+
+gboolean
+nsv_util_sf_format_to_pa(int format, pa_sample_format_t *pa_format)
+{
+  /* the samples go to PA as they are stored, so only little endian ones
+   * from an uncompressed container. FLAC reports PCM_16 too */
+  switch (format & SF_FORMAT_TYPEMASK)
+  {
+    case SF_FORMAT_WAV:
+    case SF_FORMAT_WAVEX:
+      if ((format & SF_FORMAT_ENDMASK) == SF_ENDIAN_BIG)
+        return FALSE;
+      break;
+    case SF_FORMAT_RAW:
+      if ((format & SF_FORMAT_ENDMASK) != SF_ENDIAN_LITTLE)
+        return FALSE;
+      break;
+    default:
+      return FALSE;
+  }
+
+  switch (format & SF_FORMAT_SUBMASK)
+  {
+    case SF_FORMAT_ALAW:
+      *pa_format = PA_SAMPLE_ALAW;
+      break;
+    case SF_FORMAT_ULAW:
+      *pa_format = PA_SAMPLE_ULAW;
+      break;
+    case SF_FORMAT_FLOAT:
+      *pa_format = PA_SAMPLE_FLOAT32LE;
+      break;
+    case SF_FORMAT_PCM_U8:
+      *pa_format = PA_SAMPLE_U8;
+      break;
+    case SF_FORMAT_PCM_32:
+      *pa_format = PA_SAMPLE_S32LE;
+      break;
+    case SF_FORMAT_PCM_16:
+      *pa_format = PA_SAMPLE_S16LE;
+      break;
+    default:
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static guint16
+_nsv_util_read_le16(const guint8 *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static guint32
+_nsv_util_read_le32(const guint8 *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32)p[3] << 24);
+}
+
+static gboolean
+_nsv_util_wav_fmt_to_pa(const guint8 *fmt, gsize size, pa_sample_spec *spec)
+{
+  guint16 tag;
+  guint16 bits;
+
+  if (size < 16)
+    return FALSE;
+
+  tag = _nsv_util_read_le16(fmt);
+  spec->channels = _nsv_util_read_le16(fmt + 2);
+  spec->rate = _nsv_util_read_le32(fmt + 4);
+  bits = _nsv_util_read_le16(fmt + 14);
+
+  /* WAVE_FORMAT_EXTENSIBLE, the real tag starts the sub-format GUID */
+  if (tag == 0xFFFE)
+  {
+    if (size < 40)
+      return FALSE;
+
+    tag = _nsv_util_read_le16(fmt + 24);
+  }
+
+  switch (tag)
+  {
+    case 1: /* PCM */
+    {
+      if (bits == 8)
+        spec->format = PA_SAMPLE_U8;
+      else if (bits == 16)
+        spec->format = PA_SAMPLE_S16LE;
+      else if (bits == 24)
+        spec->format = PA_SAMPLE_S24LE;
+      else if (bits == 32)
+        spec->format = PA_SAMPLE_S32LE;
+      else
+        return FALSE;
+
+      break;
+    }
+    case 3: /* IEEE float */
+    {
+      if (bits != 32)
+        return FALSE;
+
+      spec->format = PA_SAMPLE_FLOAT32LE;
+      break;
+    }
+    case 6:
+      spec->format = PA_SAMPLE_ALAW;
+      break;
+    case 7:
+      spec->format = PA_SAMPLE_ULAW;
+      break;
+    default:
+      return FALSE;
+  }
+
+  return pa_sample_spec_valid(spec);
+}
+
+gboolean
+nsv_util_wav_parse(const guint8 *data, gsize size, struct nsv_wav_info *info)
+{
+  gboolean have_fmt = FALSE;
+  gboolean have_data = FALSE;
+  guint32 loop_start = 0;
+  guint32 loop_end = 0;
+  gsize frame_size;
+  gsize pos = 12;
+
+  if (size < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4))
+    return FALSE;
+
+  info->loop_offset = 0;
+  info->loop_length = 0;
+
+  while (pos + 8 <= size)
+  {
+    const guint8 *chunk = data + pos;
+    gsize chunk_size = _nsv_util_read_le32(chunk + 4);
+
+    pos += 8;
+
+    if (!memcmp(chunk, "fmt ", 4))
+    {
+      if (chunk_size > size - pos ||
+          !_nsv_util_wav_fmt_to_pa(data + pos, chunk_size, &info->spec))
+      {
+        return FALSE;
+      }
+
+      have_fmt = TRUE;
+    }
+    else if (!memcmp(chunk, "data", 4))
+    {
+      if (!have_fmt)
+        return FALSE;
+
+      /* the size is bogus while the file is still being written */
+      if (chunk_size > size - pos)
+        chunk_size = size - pos;
+
+      info->data_offset = pos;
+      info->data_length = chunk_size - chunk_size % pa_frame_size(&info->spec);
+      have_data = TRUE;
+    }
+    else if (!memcmp(chunk, "smpl", 4) && chunk_size >= 60 &&
+             chunk_size <= size - pos && _nsv_util_read_le32(chunk + 36))
+    {
+      /* only the first loop is used, its end is inclusive */
+      loop_start = _nsv_util_read_le32(chunk + 52);
+      loop_end = _nsv_util_read_le32(chunk + 56) + 1;
+    }
+
+    if (chunk_size > size - pos)
+      break;
+
+    pos += chunk_size + (chunk_size & 1);
+  }
+
+  if (!have_data)
+    return FALSE;
+
+  frame_size = pa_frame_size(&info->spec);
+
+  if (loop_start < loop_end &&
+      (gsize)loop_end * frame_size <= info->data_length)
+  {
+    info->loop_offset = (gsize)loop_start * frame_size;
+    info->loop_length = (gsize)(loop_end - loop_start) * frame_size;
+  }
+
+  return TRUE;
+}
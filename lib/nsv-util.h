@@ -1,10 +1,22 @@
 #ifndef NSV_UTIL_H
 #define NSV_UTIL_H
 
+#include <pulse/sample.h>
+
 #include "config.h"
 
 #include "sp_timestamp.h"
 
+struct nsv_wav_info
+{
+  pa_sample_spec spec;
+  gsize data_offset;
+  gsize data_length;
+  /* from the smpl chunk, relative to the data, no loop if the length is 0 */
+  gsize loop_offset;
+  gsize loop_length;
+};
+
 void nsv_vibra_start(const char *pattern);
 void nsv_vibra_stop(const char *pattern);
 void nsv_tone_start(guint event);
@@ -14,6 +26,10 @@ void nsv_knock_stop(guint event);
 
 gboolean nsv_util_valid_sound_file(const char *file);
 gboolean nsv_util_valid_rootfs_sound_file(const char *file);
+gboolean nsv_util_readable_sound_file(const char *file, gint max_length);
+gboolean nsv_util_sf_format_to_pa(int format, pa_sample_format_t *pa_format);
+gboolean nsv_util_wav_parse(const guint8 *data, gsize size,
+                            struct nsv_wav_info *info);
 
 #define _sp_timestamp(s) sp_timestamp(PACKAGE ": " s)
 
@@ -5,10 +5,13 @@
 
 #include "nsv.h"
 #include "nsv-private.h"
+#include "nsv-buffer-arena.h"
 #include "nsv-decoder.h"
 #include "nsv-notification.h"
+#include "nsv-playback.h"
 #include "nsv-profile.h"
 #include "nsv-pulse-context.h"
+#include "nsv-sample-cache.h"
 #include "nsv-system-proxy.h"
 #include "nsv-util.h"
 
@@ -28,6 +31,7 @@ struct nsv
   Display *dpy;
   NsvProfile *profile;
   NsvPulseContext *pulse_context;
+  NsvSampleCache *sample_cache;
   NsvSystemProxy *system_proxy;
 };
 
@@ -42,6 +46,7 @@ nsv_play(const char *category, const char *sound_file, int volume,
   const char *tone;
   const char *vibra;
   gchar *decoded;
+  gchar *partial;
   const char *fallback_sound;
   gchar *fallback_sound_file;
 
@@ -80,8 +85,28 @@ nsv_play(const char *category, const char *sound_file, int volume,
     {
       if (!decoded || !g_file_test(decoded, G_FILE_TEST_EXISTS))
       {
-        if (fallback_sound && fallback_sound_file &&
-            g_file_test(fallback_sound_file, G_FILE_TEST_EXISTS))
+        /* it is needed now, don't let it wait behind the others */
+        nsv_decoder_promote(nsv->decoder, tone);
+
+        /* play the tone as it is while the decoder is still busy with it */
+        if (nsv_decoder_plays_as_decoded(nsv->decoder, tone))
+        {
+          if (n->sound_file)
+            g_free(n->sound_file);
+
+          n->sound_file = g_strdup(tone);
+        }
+        else if ((partial = nsv_decoder_get_partial_filename(nsv->decoder,
+                                                             tone)))
+        {
+          /* follow the decoder output instead of waiting for all of it */
+          if (n->sound_file)
+            g_free(n->sound_file);
+
+          n->sound_file = partial;
+        }
+        else if (fallback_sound && fallback_sound_file &&
+                 g_file_test(fallback_sound_file, G_FILE_TEST_EXISTS))
         {
           if (n->sound_file)
             g_free(n->sound_file);
@@ -97,6 +122,10 @@ nsv_play(const char *category, const char *sound_file, int volume,
         g_free(n->sound_file);
 
       n->sound_file = g_strdup(decoded);
+
+      /* decoded after the tones were preloaded, next time play it cached */
+      if (nsv->sample_cache)
+        nsv_sample_cache_preload(nsv->sample_cache, decoded);
     }
 
     if (!fallback_sound_file)
@@ -156,18 +185,12 @@ nsv_sv_stop_event(void *plugin, gint id)
 static void
 nsv_unlink_decoded(struct nsv *self, const char *tone)
 {
-  gchar *decoded;
-
   if (!self->decoder || !tone)
     return;
 
-  decoded = nsv_decoder_get_decoded_filename(self->decoder, tone);
-
-  if (decoded)
-  {
-    g_unlink(decoded);
-    g_free(decoded);
-  }
+  /* nobody is going to play it, don't finish decoding it either */
+  nsv_decoder_cancel(self->decoder, tone);
+  nsv_decoder_remove_decoded(self->decoder, tone);
 }
 
 static gboolean
@@ -189,6 +212,54 @@ nsv_is_valid_tone(NsvProfile *self, const char *tone)
   return FALSE;
 }
 
+static gchar *
+nsv_get_tone_file(struct nsv *self, const char *tone)
+{
+  if (!tone)
+    return NULL;
+
+  if (nsv_util_valid_rootfs_sound_file(tone))
+    return g_strdup(tone);
+
+  return nsv_decoder_get_decoded_filename(self->decoder, tone);
+}
+
+static void
+nsv_preload_tones(struct nsv *self)
+{
+  GList *l;
+
+  if (!self->sample_cache || !self->decoder)
+    return;
+
+  for (l = g_list_first(nsv_profile_get_tone_keys(self->profile)); l;
+       l = l->next)
+  {
+    const gchar *category = (const gchar *)l->data;
+    gchar *file =
+        nsv_get_tone_file(self, nsv_profile_get_tone(self->profile, category));
+
+    nsv_sample_cache_preload(self->sample_cache, file);
+    g_free(file);
+  }
+}
+
+static void
+nsv_preconnect_ringtone(struct nsv *self)
+{
+  gchar *file;
+
+  if (!self->profile || !self->decoder)
+    return;
+
+  /* incoming calls should not wait for a stream to be connected, ask for
+   * the same stream ringtone.c is going to */
+  file = nsv_get_tone_file(
+        self, nsv_profile_get_tone(self->profile, NSV_CATEGORY_RINGTONE));
+  nsv_playback_preconnect(file, NULL, NSV_PLAYBACK_LATENCY_POWER_SAVING);
+  g_free(file);
+}
+
 static void
 _nsv_profile_tone_changed_cb(NsvProfile *self, gchar *category, gchar *tone,
                              char *file)
@@ -198,12 +269,22 @@ _nsv_profile_tone_changed_cb(NsvProfile *self, gchar *category, gchar *tone,
   if (!nsv->decoder)
     return;
 
+  if (nsv->sample_cache && tone && !nsv_is_valid_tone(self, tone))
+  {
+    gchar *old_file = nsv_get_tone_file(nsv, tone);
+
+    nsv_sample_cache_remove(nsv->sample_cache, old_file);
+    g_free(old_file);
+  }
+
   decoded = nsv_decoder_get_decoded_filename(nsv->decoder, file);
 
   if (decoded)
   {
     if (!nsv_util_valid_sound_file(decoded))
-      nsv_decoder_decode(nsv->decoder, category, file);
+      nsv_decoder_supersede(nsv->decoder, category, file);
+    else if (nsv->sample_cache)
+      nsv_sample_cache_preload(nsv->sample_cache, decoded);
 
     if (!nsv_is_valid_tone(self, tone) )
       nsv_unlink_decoded(nsv, tone);
@@ -216,8 +297,13 @@ _nsv_profile_tone_changed_cb(NsvProfile *self, gchar *category, gchar *tone,
       nsv_unlink_decoded(nsv, tone);
 
     if (!nsv_util_valid_rootfs_sound_file(file))
-      nsv_decoder_decode(nsv->decoder, category, file);
+      nsv_decoder_supersede(nsv->decoder, category, file);
+    else if (nsv->sample_cache)
+      nsv_sample_cache_preload(nsv->sample_cache, file);
   }
+
+  if (!g_strcmp0(category, NSV_CATEGORY_RINGTONE))
+    nsv_preconnect_ringtone(nsv);
 }
 
 static void
@@ -243,7 +329,10 @@ _nsv_pulse_context_ready_cb(NsvPulseContext *self)
   {
     nsv_set_profile_pulse_context_rule_volume(
           self, nsv_profile_get_system_volume(nsv->profile));
+    nsv_preload_tones(nsv);
   }
+
+  nsv_preconnect_ringtone(nsv);
 }
 
 static gboolean
@@ -267,6 +356,9 @@ _nsv_system_proxy_startup_cb()
   if (!nsv)
     return;
 
+  /* send everything the sweep finds in one round trip */
+  nsv_decoder_begin_batch(nsv->decoder);
+
   for (l = g_list_first(nsv_profile_get_tone_keys(nsv->profile)); l;
        l = l->next)
   {
@@ -304,6 +396,7 @@ _nsv_system_proxy_startup_cb()
     }
   }
 
+  nsv_decoder_end_batch(nsv->decoder);
   g_idle_add(_nsv_unref_system_proxy_cb, NULL);
 }
 
@@ -342,6 +435,8 @@ nsv_initialize()
   nsv->decoder = nsv_decoder_new();
   g_object_set(G_OBJECT(nsv->decoder), "target-path", target_path, NULL);
 
+  nsv->sample_cache = nsv_sample_cache_get_instance();
+
   nsv->system_proxy = nsv_system_proxy_get_instance();
 
   if (nsv->system_proxy)
@@ -461,6 +556,12 @@ nsv_shutdown()
     nsv->profile = NULL;
   }
 
+  if (nsv->sample_cache)
+  {
+    g_object_unref(nsv->sample_cache);
+    nsv->sample_cache = NULL;
+  }
+
   if (nsv->pulse_context)
   {
     g_object_unref(nsv->pulse_context);
@@ -470,6 +571,7 @@ nsv_shutdown()
   g_free(nsv);
   nsv = NULL;
   nsv_notification_shutdown();
+  nsv_buffer_arena_trim();
 }
 
 gint
@@ -78,6 +78,7 @@ ringtone_play(nsv_notification *n)
                    "volume", n->volume,
                    "repeat", TRUE,
                    "min-timeout", 3000,
+                   "latency", nsv_notification_get_latency(n),
                    "event-id", "phone-incoming-call",
                    NULL);
       g_signal_connect(G_OBJECT(priv->playback), "error",
@@ -134,7 +135,8 @@ static struct notification_impl ringtone =
   NSV_CATEGORY_RINGTONE,
   NSV_CATEGORY_RINGTONE,
   100,
-  2
+  2,
+  NSV_PLAYBACK_LATENCY_POWER_SAVING
 }; // weak
 
 void
@@ -69,6 +69,7 @@ system_play(nsv_notification *n)
                  "volume", n->volume,
                  "repeat", FALSE,
                  "min-timeout", 1000,
+                 "latency", nsv_notification_get_latency(n),
                  "event-id", "dialog-information",
                  NULL);
 
@@ -112,7 +113,8 @@ static struct notification_impl system_events =
   NSV_CATEGORY_SYSTEM,
   NSV_CATEGORY_SYSTEM,
   1,
-  5
+  5,
+  NSV_PLAYBACK_LATENCY_LOW
 };
 
 static gboolean
@@ -149,6 +151,7 @@ system_play_critical(nsv_notification *n)
                  "volume", n->volume,
                  "repeat", FALSE,
                  "min-timeout", 1000,
+                 "latency", nsv_notification_get_latency(n),
                  "event-id", "dialog-information",
                  NULL);
 
@@ -202,7 +205,8 @@ static struct notification_impl critical_events =
   NSV_CATEGORY_CRITICAL,
   NSV_CATEGORY_SYSTEM,
   1,
-  5
+  5,
+  NSV_PLAYBACK_LATENCY_LOW
 };
 
 void
@@ -0,0 +1,377 @@
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "nsv-decoder-task.h"
+
+/* how many times every file of the corpus is decoded */
+#define RUNS 3
+
+struct nsv_bench_format
+{
+  const char *name;
+  const char *extension;
+  /* the factory that has to be there, and what goes in the launch line */
+  const char *factory;
+  const char *encoder;
+};
+
+static const struct nsv_bench_format formats[] =
+{
+  {"wav", "wav", "wavenc", "wavenc"},
+  {"flac", "flac", "flacenc", "flacenc"},
+  {"vorbis", "ogg", "vorbisenc", "vorbisenc ! oggmux"},
+  {"mp3", "mp3", "lamemp3enc", "lamemp3enc"}
+};
+
+static const gint lengths[] = {5, 30};
+static const gint rates[] = {22050, 44100, 48000};
+
+struct nsv_bench_run
+{
+  GMainLoop *loop;
+  gboolean succeeded;
+};
+
+static gboolean
+nsv_bench_generate(const struct nsv_bench_format *format, gint seconds,
+                   gint rate, const gchar *filename)
+{
+  GstElement *pipeline;
+  GstMessage *message;
+  GstBus *bus;
+  GError *error = NULL;
+  gboolean rv = FALSE;
+  gchar *description;
+
+  description = g_strdup_printf(
+        "audiotestsrc wave=sine num-buffers=%d samplesperbuffer=1024 ! "
+        "audio/x-raw,rate=%d,channels=2 ! audioconvert ! %s ! "
+        "filesink location=\"%s\"",
+        (seconds * rate + 1023) / 1024, rate, format->encoder, filename);
+  pipeline = gst_parse_launch(description, &error);
+  g_free(description);
+
+  if (!pipeline)
+  {
+    g_printerr("Can't generate %s: %s\n", filename, error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus(pipeline);
+  message = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+                                       GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+  if (message)
+  {
+    rv = GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS;
+    gst_message_unref(message);
+  }
+
+  gst_object_unref(bus);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+
+  if (!rv)
+    g_unlink(filename);
+
+  return rv;
+}
+
+static void
+_nsv_bench_task_succeeded_cb(NsvDecoderTask *task, struct nsv_bench_run *run)
+{
+  run->succeeded = TRUE;
+  g_main_loop_quit(run->loop);
+}
+
+static void
+_nsv_bench_task_error_cb(NsvDecoderTask *task, struct nsv_bench_run *run)
+{
+  g_main_loop_quit(run->loop);
+}
+
+static gboolean
+nsv_bench_decode(NsvDecoderPipeline *pipeline, const gchar *source_file,
+                 const gchar *target_file, const gchar *format,
+                 gint64 *wall_time, gint64 *audio_time)
+{
+  NsvDecoderTask *task = nsv_decoder_task_new(source_file, target_file);
+  struct nsv_bench_run run = {NULL, FALSE};
+
+  g_object_set(task, "format", format, NULL);
+  run.loop = g_main_loop_new(NULL, FALSE);
+  g_signal_connect(task, "succeeded",
+                   G_CALLBACK(_nsv_bench_task_succeeded_cb), &run);
+  g_signal_connect(task, "error", G_CALLBACK(_nsv_bench_task_error_cb), &run);
+
+  if (nsv_decoder_task_start(task, pipeline))
+    g_main_loop_run(run.loop);
+
+  *wall_time = nsv_decoder_task_get_wall_time(task);
+  *audio_time = nsv_decoder_task_get_audio_time(task);
+
+  /* the pipeline is reused by the next run */
+  nsv_decoder_task_take_pipeline(task);
+  g_object_unref(task);
+  g_main_loop_unref(run.loop);
+
+  return run.succeeded;
+}
+
+static glong
+nsv_bench_get_peak_rss()
+{
+  struct rusage usage;
+
+  /* in KiB on Linux */
+  if (getrusage(RUSAGE_SELF, &usage))
+    return -1;
+
+  return usage.ru_maxrss;
+}
+
+static gdouble
+nsv_bench_realtime_factor(gint64 audio_time, gint64 wall_time)
+{
+  return wall_time ? (gdouble)audio_time / wall_time : 0.0;
+}
+
+static void
+nsv_bench_append_separator(GString *json)
+{
+  if (json->len)
+    g_string_append(json, ",\n");
+}
+
+static void
+nsv_bench_remove_dir(const gchar *dirname)
+{
+  GDir *dir = g_dir_open(dirname, 0, NULL);
+  const gchar *name;
+
+  if (!dir)
+    return;
+
+  while ((name = g_dir_read_name(dir)))
+  {
+    gchar *filename = g_build_filename(dirname, name, NULL);
+
+    g_unlink(filename);
+    g_free(filename);
+  }
+
+  g_dir_close(dir);
+  g_rmdir(dirname);
+}
+
+int
+main(int argc, char **argv)
+{
+  GOptionContext *option_context;
+  GError *error = NULL;
+  gchar *dir = NULL;
+  gchar *format = NULL;
+  gint runs = RUNS;
+  gboolean keep = FALSE;
+  gboolean temporary;
+  GString *files = g_string_new(NULL);
+  GString *summaries = g_string_new(NULL);
+  GString *skipped = g_string_new(NULL);
+  guint f;
+  guint l;
+  guint r;
+  gint i;
+  GOptionEntry entries[] =
+  {
+    {"dir", 'd', 0, G_OPTION_ARG_FILENAME, &dir,
+     "Where the corpus is kept, a temporary one otherwise", "DIR"},
+    {"runs", 'n', 0, G_OPTION_ARG_INT, &runs,
+     "How many times every file is decoded", "N"},
+    {"format", 'f', 0, G_OPTION_ARG_STRING, &format,
+     "Decode to alaw or mulaw instead of 16 bit PCM", "FORMAT"},
+    {"keep", 'k', 0, G_OPTION_ARG_NONE, &keep,
+     "Keep the decoded files", NULL},
+    {NULL}
+  };
+
+#if !GLIB_CHECK_VERSION(2,32,0)
+  g_thread_init(NULL);
+#endif
+#if !GLIB_CHECK_VERSION(2,35,0)
+  g_type_init ();
+#endif
+  option_context = g_option_context_new(NULL);
+  g_option_context_add_main_entries(option_context, entries, NULL);
+  g_option_context_add_group(option_context, gst_init_get_option_group());
+
+  if (!g_option_context_parse(option_context, &argc, &argv, &error))
+  {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    g_option_context_free(option_context);
+    return 1;
+  }
+
+  g_option_context_free(option_context);
+
+  temporary = !dir;
+
+  if (temporary)
+    dir = g_dir_make_tmp("nsv-decoder-bench-XXXXXX", &error);
+  else
+    g_mkdir_with_parents(dir, 0755);
+
+  if (!dir)
+  {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  runs = MAX(runs, 1);
+
+  for (f = 0; f < G_N_ELEMENTS(formats); f++)
+  {
+    GstElementFactory *factory =
+        gst_element_factory_find(formats[f].factory);
+    gint64 total_audio_time = 0;
+    gint64 total_wall_time = 0;
+    gint64 total_setup_time = 0;
+    guint64 total_size = 0;
+    guint decoded = 0;
+    guint failed = 0;
+
+    /* mp3 encoders are often missing, benchmark what can be generated */
+    if (!factory)
+    {
+      nsv_bench_append_separator(skipped);
+      g_string_append_printf(skipped, "    \"%s\"", formats[f].name);
+      continue;
+    }
+
+    gst_object_unref(factory);
+
+    for (l = 0; l < G_N_ELEMENTS(lengths); l++)
+    {
+      for (r = 0; r < G_N_ELEMENTS(rates); r++)
+      {
+        NsvDecoderPipeline *pipeline;
+        gint64 setup_time;
+        gint64 wall_time = 0;
+        gint64 audio_time = 0;
+        gchar *source_file;
+        gchar *target_file;
+        GStatBuf st;
+        guint64 size = 0;
+
+        source_file = g_strdup_printf("%s/%s-%ds-%d.%s", dir,
+                                      formats[f].name, lengths[l], rates[r],
+                                      formats[f].extension);
+        target_file = g_strdup_printf("%s/%s-%ds-%d.decoded.wav", dir,
+                                      formats[f].name, lengths[l], rates[r]);
+
+        if (!g_file_test(source_file, G_FILE_TEST_EXISTS) &&
+            !nsv_bench_generate(&formats[f], lengths[l], rates[r],
+                                source_file))
+        {
+          failed++;
+          goto next;
+        }
+
+        setup_time = g_get_monotonic_time();
+        pipeline = nsv_decoder_pipeline_new();
+        setup_time = g_get_monotonic_time() - setup_time;
+
+        if (!pipeline)
+        {
+          failed++;
+          goto next;
+        }
+
+        for (i = 0; i < runs; i++)
+        {
+          gint64 run_wall_time;
+          gint64 run_audio_time;
+
+          if (!nsv_bench_decode(pipeline, source_file, target_file, format,
+                                &run_wall_time, &run_audio_time))
+          {
+            break;
+          }
+
+          wall_time += run_wall_time;
+          audio_time += run_audio_time;
+        }
+
+        nsv_decoder_pipeline_free(pipeline);
+
+        if (i < runs)
+        {
+          g_printerr("Decoding %s failed\n", source_file);
+          failed++;
+          goto next;
+        }
+
+        if (!g_stat(target_file, &st))
+          size = st.st_size;
+
+        decoded++;
+        total_audio_time += audio_time / runs;
+        total_wall_time += wall_time / runs;
+        total_setup_time += setup_time;
+        total_size += size;
+
+        nsv_bench_append_separator(files);
+        g_string_append_printf(
+              files,
+              "    {\"format\": \"%s\", \"seconds\": %d, \"rate\": %d, "
+              "\"runs\": %d, \"decode-ms\": %.3f, \"realtime-factor\": %.2f, "
+              "\"pipeline-setup-ms\": %.3f, \"output-bytes\": %"
+              G_GUINT64_FORMAT "}",
+              formats[f].name, lengths[l], rates[r], runs,
+              wall_time / (gdouble)runs / 1000,
+              nsv_bench_realtime_factor(audio_time, wall_time),
+              setup_time / 1000.0, size);
+
+next:
+        if (!keep)
+          g_unlink(target_file);
+
+        g_free(source_file);
+        g_free(target_file);
+      }
+    }
+
+    /* the peak only ever grows, so this is the peak up to this format */
+    nsv_bench_append_separator(summaries);
+    g_string_append_printf(
+          summaries,
+          "    {\"format\": \"%s\", \"decoded\": %u, \"failed\": %u, "
+          "\"realtime-factor\": %.2f, \"pipeline-setup-ms\": %.3f, "
+          "\"output-bytes\": %" G_GUINT64_FORMAT ", \"peak-rss-kb\": %ld}",
+          formats[f].name, decoded, failed,
+          nsv_bench_realtime_factor(total_audio_time, total_wall_time),
+          decoded ? total_setup_time / (gdouble)decoded / 1000 : 0.0,
+          total_size, nsv_bench_get_peak_rss());
+  }
+
+  g_print("{\n  \"files\": [\n%s\n  ],\n  \"formats\": [\n%s\n  ],\n"
+          "  \"skipped\": [\n%s\n  ]\n}\n",
+          files->str, summaries->str, skipped->str);
+
+  if (temporary && !keep)
+    nsv_bench_remove_dir(dir);
+
+  g_string_free(files, TRUE);
+  g_string_free(summaries, TRUE);
+  g_string_free(skipped, TRUE);
+  g_free(format);
+  g_free(dir);
+
+  return 0;
+}
@@ -6,10 +6,27 @@
 #include "nsv-service-marshal.h"
 
 static void nsv_decoder_service_decode();
+static void nsv_decoder_service_decode_with_options();
+static void nsv_decoder_service_decode_many();
+static void nsv_decoder_service_promote();
+static void nsv_decoder_service_cancel();
+static void nsv_decoder_service_get_stats();
 #include "dbus-glib-marshal-nsv-decoder-service.h"
 
 #include "nsv-decoder-task.h"
 
+#define NSV_DECODER_TYPE_OPTIONS (dbus_g_type_get_map("GHashTable", \
+            G_TYPE_STRING, G_TYPE_VALUE))
+#define NSV_DECODER_TYPE_REQUEST (dbus_g_type_get_struct("GValueArray", \
+            G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, \
+            NSV_DECODER_TYPE_OPTIONS, G_TYPE_INVALID))
+#define NSV_DECODER_TYPE_REQUESTS (dbus_g_type_get_collection("GPtrArray", \
+            NSV_DECODER_TYPE_REQUEST))
+#define NSV_DECODER_TYPE_RESULT (dbus_g_type_get_struct("GValueArray", \
+            G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INVALID))
+#define NSV_DECODER_TYPE_RESULTS (dbus_g_type_get_collection("GPtrArray", \
+            NSV_DECODER_TYPE_RESULT))
+
 #define NSV_DECODER_SERVICE_TYPE (nsv_decoder_service_get_type ())
 #define NSV_DECODER_SERVICE(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
             NSV_DECODER_SERVICE_TYPE, NsvDecoderService))
@@ -34,8 +51,62 @@ struct _NsvDecoderServicePrivate
   DBusGProxy *proxy;
   GError *error;
   GQueue queue;
-  NsvDecoderTask *current_task;
+  GQueue pipelines;
+  GList *running_tasks;
+  GHashTable *jobs;
+  guint max_tasks;
+  guint min_lifetime;
+  guint max_lifetime;
+  guint idle_timeout;
   guint exit_timeout_id;
+  GMainLoop *loop;
+  gint64 start_time;
+  gint64 busy_since;
+  gint64 busy_time;
+  guint tasks_done;
+  guint stats_timeout_id;
+  guint decoded;
+  guint failed;
+  guint cancelled;
+  guint64 bytes_written;
+  gint64 decode_time;
+  gint64 audio_time;
+  gint64 last_decode_time;
+  gint64 last_audio_time;
+  guint pipelines_built;
+  gint64 pipeline_build_time;
+  GHashTable *errors;
+};
+
+enum
+{
+  PROP_0,
+  PROP_MAX_TASKS,
+  PROP_MIN_LIFETIME,
+  PROP_MAX_LIFETIME
+};
+
+/* a DecodeMany call, answered with a single BatchDecoded */
+struct nsv_decode_batch
+{
+  guint id;
+  guint pending;
+  GPtrArray *decoded;
+  GPtrArray *failed;
+};
+
+struct nsv_decode_waiter
+{
+  struct nsv_decode_batch *batch;
+  gchar *category;
+};
+
+/* a source/target pair that is queued or being decoded */
+struct nsv_decode_job
+{
+  NsvDecoderTask *task;
+  GSList *categories;
+  GSList *waiters;
 };
 
 G_DEFINE_TYPE_WITH_CODE(NsvDecoderService, nsv_decoder_service, G_TYPE_OBJECT, G_ADD_PRIVATE(NsvDecoderService));
@@ -45,15 +116,66 @@ static void nsv_decoder_service_start_next_task(NsvDecoderService *self);
 static GObjectClass *parent_class = NULL;
 static guint decoded_id;
 static guint error_decoding_id;
+static guint batch_decoded_id;
+static guint stats_id;
 
 #define EXIT_TIMEOUT 5
 
+/* how long the idle timeout may grow while requests keep coming */
+#define MAX_LIFETIME 160
+
+/* upper bound of concurrent pipelines, whatever the CPU count is */
+#define MAX_TASKS 4
+
+/* how often Stats is emitted while busy */
+#define STATS_INTERVAL 10
+
+/* what a promoted task jumps the queue with */
+#define PRIORITY_PROMOTED G_MAXINT
+
+static gchar *
+nsv_decoder_service_job_key(const char *source_file, const char *target_file)
+{
+  return g_strconcat(source_file, "\n", target_file, NULL);
+}
+
+static void
+nsv_decoder_service_job_free(gpointer data)
+{
+  struct nsv_decode_job *job = (struct nsv_decode_job *)data;
+  GSList *l;
+
+  for (l = job->waiters; l; l = l->next)
+  {
+    struct nsv_decode_waiter *waiter = (struct nsv_decode_waiter *)l->data;
+
+    g_free(waiter->category);
+    g_slice_free(struct nsv_decode_waiter, waiter);
+  }
+
+  g_slist_free(job->waiters);
+  g_slist_free_full(job->categories, g_free);
+  g_slice_free(struct nsv_decode_job, job);
+}
+
 static void
 nsv_decoder_service_dispose(GObject *object)
 {
   NsvDecoderService *self = NSV_DECODER_SERVICE(object);
   NsvDecoderServicePrivate *priv = self->priv;
 
+  if (priv->exit_timeout_id)
+  {
+    g_source_remove(priv->exit_timeout_id);
+    priv->exit_timeout_id = 0;
+  }
+
+  if (priv->stats_timeout_id)
+  {
+    g_source_remove(priv->stats_timeout_id);
+    priv->stats_timeout_id = 0;
+  }
+
   if (priv->proxy)
   {
     g_object_unref(priv->proxy);
@@ -66,21 +188,125 @@ nsv_decoder_service_dispose(GObject *object)
     priv->conn = NULL;
   }
 
-  if (priv->current_task)
+  if (priv->running_tasks)
   {
-    g_object_unref(priv->current_task);
-    priv->current_task = NULL;
+    g_list_free_full(priv->running_tasks, g_object_unref);
+    priv->running_tasks = NULL;
   }
 
   g_queue_clear(&priv->queue);
+
+  while (!g_queue_is_empty(&priv->pipelines))
+  {
+    nsv_decoder_pipeline_free(
+          (NsvDecoderPipeline *)g_queue_pop_head(&priv->pipelines));
+  }
+
+  if (priv->jobs)
+  {
+    g_hash_table_destroy(priv->jobs);
+    priv->jobs = NULL;
+  }
+
+  if (priv->errors)
+  {
+    g_hash_table_destroy(priv->errors);
+    priv->errors = NULL;
+  }
+
   G_OBJECT_CLASS(parent_class)->dispose(object);
 }
 
+static void
+nsv_decoder_service_set_property(GObject *object, guint prop_id,
+                                 const GValue *value, GParamSpec *pspec)
+{
+  NsvDecoderServicePrivate *priv = NSV_DECODER_SERVICE(object)->priv;
+
+  switch (prop_id)
+  {
+    case PROP_MAX_TASKS:
+    {
+      priv->max_tasks = g_value_get_uint(value);
+      break;
+    }
+    case PROP_MIN_LIFETIME:
+    {
+      priv->min_lifetime = g_value_get_uint(value);
+      priv->idle_timeout = priv->min_lifetime;
+      break;
+    }
+    case PROP_MAX_LIFETIME:
+    {
+      priv->max_lifetime = g_value_get_uint(value);
+      break;
+    }
+    default:
+    {
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+      break;
+    }
+  }
+}
+
+static void
+nsv_decoder_service_get_property(GObject *object, guint prop_id,
+                                 GValue *value, GParamSpec *pspec)
+{
+  NsvDecoderServicePrivate *priv = NSV_DECODER_SERVICE(object)->priv;
+
+  switch (prop_id)
+  {
+    case PROP_MAX_TASKS:
+    {
+      g_value_set_uint(value, priv->max_tasks);
+      break;
+    }
+    case PROP_MIN_LIFETIME:
+    {
+      g_value_set_uint(value, priv->min_lifetime);
+      break;
+    }
+    case PROP_MAX_LIFETIME:
+    {
+      g_value_set_uint(value, priv->max_lifetime);
+      break;
+    }
+    default:
+    {
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+      break;
+    }
+  }
+}
+
 static void
 nsv_decoder_service_class_init(NsvDecoderServiceClass *klass)
 {
+  GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
   parent_class = g_type_class_peek_parent(klass);
-  G_OBJECT_CLASS(klass)->dispose = nsv_decoder_service_dispose;
+  object_class->dispose = nsv_decoder_service_dispose;
+  object_class->set_property = nsv_decoder_service_set_property;
+  object_class->get_property = nsv_decoder_service_get_property;
+
+  g_object_class_install_property(
+        object_class, PROP_MAX_TASKS,
+        g_param_spec_uint("max-tasks",
+                          NULL, NULL, 1, G_MAXUINT, 1,
+                          G_PARAM_CONSTRUCT | G_PARAM_READWRITE));
+  g_object_class_install_property(
+        object_class, PROP_MIN_LIFETIME,
+        g_param_spec_uint("min-lifetime",
+                          NULL, "Seconds to stay around once idle",
+                          1, G_MAXUINT, EXIT_TIMEOUT,
+                          G_PARAM_CONSTRUCT | G_PARAM_READWRITE));
+  g_object_class_install_property(
+        object_class, PROP_MAX_LIFETIME,
+        g_param_spec_uint("max-lifetime",
+                          NULL, "Upper bound of the idle timeout in seconds",
+                          1, G_MAXUINT, MAX_LIFETIME,
+                          G_PARAM_CONSTRUCT | G_PARAM_READWRITE));
 
   decoded_id =
       g_signal_new("decoded",
@@ -96,6 +322,21 @@ nsv_decoder_service_class_init(NsvDecoderServiceClass *klass)
                    nsv_service_marshal_VOID__STRING_STRING_STRING,
                    G_TYPE_NONE, 3, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
 
+  batch_decoded_id =
+      g_signal_new("batch-decoded",
+                   G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+                   0, NULL, NULL,
+                   nsv_service_marshal_VOID__UINT_BOXED_BOXED,
+                   G_TYPE_NONE, 3, G_TYPE_UINT, NSV_DECODER_TYPE_RESULTS,
+                   NSV_DECODER_TYPE_RESULTS);
+
+  stats_id =
+      g_signal_new("stats",
+                   G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+                   0, NULL, NULL,
+                   g_cclosure_marshal_VOID__BOXED,
+                   G_TYPE_NONE, 1, NSV_DECODER_TYPE_OPTIONS);
+
   dbus_g_object_type_install_info(NSV_DECODER_SERVICE_TYPE,
                                   &dbus_glib_nsv_decoder_service_object_info);
 }
@@ -103,8 +344,30 @@ nsv_decoder_service_class_init(NsvDecoderServiceClass *klass)
 static gboolean
 exit_timeout_cb(gpointer user_data)
 {
+  NsvDecoderServicePrivate *priv = NSV_DECODER_SERVICE(user_data)->priv;
+
   g_debug("Timed out, exiting");
-  exit(0);
+  priv->exit_timeout_id = 0;
+
+  if (priv->loop)
+    g_main_loop_quit(priv->loop);
+  else
+    exit(0);
+
+  return FALSE;
+}
+
+static void
+nsv_decoder_service_schedule_exit(NsvDecoderService *self)
+{
+  NsvDecoderServicePrivate *priv = self->priv;
+
+  if (priv->exit_timeout_id)
+    return;
+
+  g_debug("Idle, exiting in %u seconds", priv->idle_timeout);
+  priv->exit_timeout_id =
+      g_timeout_add_seconds(priv->idle_timeout, exit_timeout_cb, self);
 }
 
 static void
@@ -114,6 +377,11 @@ nsv_decoder_service_init(NsvDecoderService *self)
 
   self->priv = priv;
   g_queue_init(&priv->queue);
+  g_queue_init(&priv->pipelines);
+  priv->jobs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                     nsv_decoder_service_job_free);
+  priv->errors = g_hash_table_new(g_str_hash, g_str_equal);
+  priv->start_time = g_get_monotonic_time();
   priv->conn = dbus_g_bus_get(DBUS_BUS_SESSION, &priv->error);
 
   if (priv->conn)
@@ -135,21 +403,22 @@ nsv_decoder_service_init(NsvDecoderService *self)
                                           &nameret,
                                           &self->priv->error))
     {
-      if (nameret == DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER)
-      {
-        priv->exit_timeout_id =
-            g_timeout_add_seconds(EXIT_TIMEOUT, exit_timeout_cb, NULL);
-      }
-      else
+      if (nameret != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER)
         priv->error = g_error_new(0, 0, "Service already exists");
     }
   }
 }
 
-NsvDecoderService *nsv_decoder_service_new()
+NsvDecoderService *nsv_decoder_service_new(guint max_tasks,
+                                           guint min_lifetime,
+                                           guint max_lifetime)
 {
   NsvDecoderService *self =
-      (NsvDecoderService *)g_object_new(NSV_DECODER_SERVICE_TYPE, NULL);
+      (NsvDecoderService *)g_object_new(NSV_DECODER_SERVICE_TYPE,
+                                        "max-tasks", max_tasks,
+                                        "min-lifetime", min_lifetime,
+                                        "max-lifetime", max_lifetime,
+                                        NULL);
 
   if (self->priv->error)
   {
@@ -160,24 +429,279 @@ NsvDecoderService *nsv_decoder_service_new()
       ;
   }
 
+  /* the request that activated us is on its way */
+  nsv_decoder_service_schedule_exit(self);
+
   return self;
 }
 
 static void
-_nsv_decoder_service_task_succeeded_cb(NsvDecoderTask *task,
-                                       NsvDecoderService *service)
+nsv_decoder_service_run(NsvDecoderService *self)
+{
+  NsvDecoderServicePrivate *priv = self->priv;
+  gint64 total;
+
+  priv->loop = g_main_loop_new(NULL, FALSE);
+  g_main_loop_run(priv->loop);
+  g_main_loop_unref(priv->loop);
+  priv->loop = NULL;
+
+  total = g_get_monotonic_time() - priv->start_time;
+  g_message("Exiting after %.1f s, %u files in %.1f s busy, %.1f s idle",
+            total / (gdouble)G_USEC_PER_SEC, priv->tasks_done,
+            priv->busy_time / (gdouble)G_USEC_PER_SEC,
+            (total - priv->busy_time) / (gdouble)G_USEC_PER_SEC);
+}
+
+static void
+nsv_decoder_service_value_free(gpointer data)
+{
+  GValue *value = (GValue *)data;
+
+  g_value_unset(value);
+  g_slice_free(GValue, value);
+}
+
+static GValue *
+nsv_decoder_service_stats_add(GHashTable *stats, const char *name, GType type)
+{
+  GValue *value = g_slice_new0(GValue);
+
+  g_value_init(value, type);
+  g_hash_table_insert(stats, (gpointer)name, value);
+
+  return value;
+}
+
+static gdouble
+nsv_decoder_service_realtime_factor(gint64 audio_time, gint64 decode_time)
+{
+  return decode_time ? (gdouble)audio_time / decode_time : 0.0;
+}
+
+static GHashTable *
+nsv_decoder_service_collect_stats(NsvDecoderService *self)
+{
+  NsvDecoderServicePrivate *priv = self->priv;
+  GHashTable *stats = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                            nsv_decoder_service_value_free);
+  GHashTable *errors = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                             nsv_decoder_service_value_free);
+  guint64 bytes_written = priv->bytes_written;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  GList *l;
+
+  /* count what the running ones have written so far too */
+  for (l = priv->running_tasks; l; l = l->next)
+  {
+    bytes_written +=
+        nsv_decoder_task_get_bytes_written((NsvDecoderTask *)l->data);
+  }
+
+  g_value_set_uint(
+        nsv_decoder_service_stats_add(stats, "queued", G_TYPE_UINT),
+        g_queue_get_length(&priv->queue));
+  g_value_set_uint(
+        nsv_decoder_service_stats_add(stats, "running", G_TYPE_UINT),
+        g_list_length(priv->running_tasks));
+  g_value_set_uint(
+        nsv_decoder_service_stats_add(stats, "decoded", G_TYPE_UINT),
+        priv->decoded);
+  g_value_set_uint(
+        nsv_decoder_service_stats_add(stats, "failed", G_TYPE_UINT),
+        priv->failed);
+  g_value_set_uint(
+        nsv_decoder_service_stats_add(stats, "cancelled", G_TYPE_UINT),
+        priv->cancelled);
+  g_value_set_uint64(
+        nsv_decoder_service_stats_add(stats, "bytes-written", G_TYPE_UINT64),
+        bytes_written);
+
+  /* times are in seconds */
+  g_value_set_double(
+        nsv_decoder_service_stats_add(stats, "decode-time", G_TYPE_DOUBLE),
+        priv->decode_time / (gdouble)G_USEC_PER_SEC);
+  g_value_set_double(
+        nsv_decoder_service_stats_add(stats, "realtime-factor",
+                                      G_TYPE_DOUBLE),
+        nsv_decoder_service_realtime_factor(priv->audio_time,
+                                            priv->decode_time));
+  g_value_set_double(
+        nsv_decoder_service_stats_add(stats, "last-decode-time",
+                                      G_TYPE_DOUBLE),
+        priv->last_decode_time / (gdouble)G_USEC_PER_SEC);
+  g_value_set_double(
+        nsv_decoder_service_stats_add(stats, "last-realtime-factor",
+                                      G_TYPE_DOUBLE),
+        nsv_decoder_service_realtime_factor(priv->last_audio_time,
+                                            priv->last_decode_time));
+  g_value_set_uint(
+        nsv_decoder_service_stats_add(stats, "pipelines-built", G_TYPE_UINT),
+        priv->pipelines_built);
+  g_value_set_double(
+        nsv_decoder_service_stats_add(stats, "pipeline-build-time",
+                                      G_TYPE_DOUBLE),
+        priv->pipeline_build_time / (gdouble)G_USEC_PER_SEC);
+
+  /* error counts by GError domain */
+  g_hash_table_iter_init(&iter, priv->errors);
+
+  while (g_hash_table_iter_next(&iter, &key, &value))
+  {
+    g_value_set_uint(nsv_decoder_service_stats_add(errors, (const char *)key,
+                                                   G_TYPE_UINT),
+                     GPOINTER_TO_UINT(value));
+  }
+
+  g_value_take_boxed(
+        nsv_decoder_service_stats_add(stats, "errors",
+                                      NSV_DECODER_TYPE_OPTIONS),
+        errors);
+
+  return stats;
+}
+
+static void
+nsv_decoder_service_emit_stats(NsvDecoderService *self)
+{
+  GHashTable *stats = nsv_decoder_service_collect_stats(self);
+
+  g_signal_emit(self, stats_id, 0, stats);
+  g_hash_table_unref(stats);
+}
+
+static gboolean
+stats_timeout_cb(gpointer user_data)
+{
+  nsv_decoder_service_emit_stats(NSV_DECODER_SERVICE(user_data));
+
+  return TRUE;
+}
+
+static void
+nsv_decoder_service_count_failure(NsvDecoderService *self, GQuark domain)
+{
+  NsvDecoderServicePrivate *priv = self->priv;
+  const gchar *name;
+
+  priv->failed++;
+
+  if (!domain)
+    return;
+
+  /* quark strings stay around for good */
+  name = g_quark_to_string(domain);
+  g_hash_table_insert(
+        priv->errors, (gpointer)name,
+        GUINT_TO_POINTER(GPOINTER_TO_UINT(
+                           g_hash_table_lookup(priv->errors, name)) + 1));
+}
+
+static void
+nsv_decoder_service_append_result(GPtrArray *results, const gchar *category,
+                                  const char *source_file,
+                                  const char *target_file)
+{
+  GValue value = {0, };
+
+  g_value_init(&value, NSV_DECODER_TYPE_RESULT);
+  g_value_take_boxed(&value, dbus_g_type_specialized_construct(
+                       NSV_DECODER_TYPE_RESULT));
+  dbus_g_type_struct_set(&value,
+                         0, category,
+                         1, source_file,
+                         2, target_file,
+                         G_MAXUINT);
+  g_ptr_array_add(results, g_value_dup_boxed(&value));
+  g_value_unset(&value);
+}
+
+static void
+nsv_decoder_service_batch_release(NsvDecoderService *self,
+                                  struct nsv_decode_batch *batch)
 {
+  if (--batch->pending)
+    return;
+
+  g_signal_emit(self, batch_decoded_id, 0, batch->id, batch->decoded,
+                batch->failed);
+  g_boxed_free(NSV_DECODER_TYPE_RESULTS, batch->decoded);
+  g_boxed_free(NSV_DECODER_TYPE_RESULTS, batch->failed);
+  g_slice_free(struct nsv_decode_batch, batch);
+}
+
+static void
+nsv_decoder_service_task_done(NsvDecoderService *self, NsvDecoderTask *task,
+                              guint signal_id)
+{
+  NsvDecoderServicePrivate *priv = self->priv;
+  NsvDecoderPipeline *pipeline;
+  struct nsv_decode_job *job;
   gchar *target_file = NULL;
   gchar *source_file = NULL;
+  gchar *key;
+  GSList *l;
 
   g_object_get(task, "source-file", &source_file, "target-file", &target_file,
                NULL);
-  g_signal_emit(service, decoded_id, 0, task->category, source_file,
-                target_file);
+  key = nsv_decoder_service_job_key(source_file, target_file);
+  job = (struct nsv_decode_job *)g_hash_table_lookup(priv->jobs, key);
+
+  /* everybody who asked for this file gets the result */
+  for (l = job ? job->categories : NULL; l; l = l->next)
+  {
+    g_signal_emit(self, signal_id, 0, (const gchar *)l->data, source_file,
+                  target_file);
+  }
+
+  for (l = job ? job->waiters : NULL; l; l = l->next)
+  {
+    struct nsv_decode_waiter *waiter = (struct nsv_decode_waiter *)l->data;
+    struct nsv_decode_batch *batch = waiter->batch;
+
+    nsv_decoder_service_append_result(
+          signal_id == decoded_id ? batch->decoded : batch->failed,
+          waiter->category, source_file, target_file);
+    nsv_decoder_service_batch_release(self, batch);
+  }
+
+  priv->bytes_written += nsv_decoder_task_get_bytes_written(task);
+
+  if (signal_id == decoded_id)
+  {
+    priv->last_decode_time = nsv_decoder_task_get_wall_time(task);
+    priv->last_audio_time = nsv_decoder_task_get_audio_time(task);
+    priv->decode_time += priv->last_decode_time;
+    priv->audio_time += priv->last_audio_time;
+
+    g_debug("Decoded %s in %.2f s, %.1fx realtime", source_file,
+            priv->last_decode_time / (gdouble)G_USEC_PER_SEC,
+            nsv_decoder_service_realtime_factor(priv->last_audio_time,
+                                                priv->last_decode_time));
+  }
+
+  g_hash_table_remove(priv->jobs, key);
+  g_free(key);
   g_free(source_file);
   g_free(target_file);
-  g_object_unref(service->priv->current_task);
-  service->priv->current_task = NULL;
+
+  /* keep the graph for the next task */
+  if ((pipeline = nsv_decoder_task_take_pipeline(task)))
+    g_queue_push_head(&priv->pipelines, pipeline);
+
+  priv->running_tasks = g_list_remove(priv->running_tasks, task);
+  priv->tasks_done++;
+  g_object_unref(task);
+}
+
+static void
+_nsv_decoder_service_task_succeeded_cb(NsvDecoderTask *task,
+                                       NsvDecoderService *service)
+{
+  service->priv->decoded++;
+  nsv_decoder_service_task_done(service, task, decoded_id);
   nsv_decoder_service_start_next_task(service);
 }
 
@@ -185,18 +709,10 @@ static void
 _nsv_decoder_service_task_error_cb(NsvDecoderTask *task,
                                    NsvDecoderService *service)
 {
-  gchar *target_file = NULL;
-  gchar *source_file = NULL;
-
-  nsv_decoder_task_stop(service->priv->current_task);
-  g_object_get(task, "source-file", &source_file, "target-file", &target_file,
-               NULL);
-  g_signal_emit(service, error_decoding_id, 0, task->category, source_file,
-                target_file);
-  g_free(source_file);
-  g_free(target_file);
-  g_object_unref(service->priv->current_task);
-  service->priv->current_task = NULL;
+  nsv_decoder_service_count_failure(service,
+                                    nsv_decoder_task_get_error_domain(task));
+  nsv_decoder_task_stop(task);
+  nsv_decoder_service_task_done(service, task, error_decoding_id);
   nsv_decoder_service_start_next_task(service);
 }
 
@@ -204,12 +720,11 @@ static void
 nsv_decoder_service_start_next_task(NsvDecoderService *self)
 {
   NsvDecoderServicePrivate *priv = self->priv;
+  NsvDecoderPipeline *pipeline;
   NsvDecoderTask *task;
 
-  if (priv->current_task)
-    return;
-
-  while((task = (NsvDecoderTask *)g_queue_pop_head(&priv->queue)))
+  while(g_list_length(priv->running_tasks) < priv->max_tasks &&
+        (task = (NsvDecoderTask *)g_queue_pop_head(&priv->queue)))
   {
     g_signal_connect_data(task, "succeeded",
                           (GCallback)_nsv_decoder_service_task_succeeded_cb,
@@ -218,34 +733,269 @@ nsv_decoder_service_start_next_task(NsvDecoderService *self)
                           (GCallback)_nsv_decoder_service_task_error_cb,
                           self, NULL, 0);
 
-    if (!nsv_decoder_task_start(task))
+    pipeline = (NsvDecoderPipeline *)g_queue_pop_head(&priv->pipelines);
+
+    if (!pipeline)
+    {
+      gint64 now = g_get_monotonic_time();
+
+      pipeline = nsv_decoder_pipeline_new();
+      priv->pipeline_build_time += g_get_monotonic_time() - now;
+      priv->pipelines_built++;
+    }
+
+    /* task_done() hands the pipeline back, if the task got it */
+    if (!nsv_decoder_task_start(task, pipeline))
+    {
+      nsv_decoder_service_count_failure(self, 0);
+      nsv_decoder_service_task_done(self, task, error_decoding_id);
+    }
+    else
+      priv->running_tasks = g_list_prepend(priv->running_tasks, task);
+  }
+
+  if (priv->running_tasks && !priv->busy_since)
+  {
+    priv->busy_since = g_get_monotonic_time();
+    priv->stats_timeout_id =
+        g_timeout_add_seconds(STATS_INTERVAL, stats_timeout_cb, self);
+  }
+  else if (!priv->running_tasks)
+  {
+    if (priv->busy_since)
     {
-      gchar *source_file = NULL;
-      gchar *target_file = NULL;
+      priv->busy_time += g_get_monotonic_time() - priv->busy_since;
+      priv->busy_since = 0;
+    }
+
+    /* once more with the final numbers */
+    if (priv->stats_timeout_id)
+    {
+      g_source_remove(priv->stats_timeout_id);
+      priv->stats_timeout_id = 0;
+      nsv_decoder_service_emit_stats(self);
+    }
+
+    nsv_decoder_service_schedule_exit(self);
+  }
+}
+
+static void
+nsv_decoder_service_cancel_job(NsvDecoderService *self,
+                               struct nsv_decode_job *job)
+{
+  NsvDecoderServicePrivate *priv = self->priv;
+  NsvDecoderTask *task = job->task;
+
+  priv->cancelled++;
+
+  /* a queued one has not touched the target, which may be shared */
+  if (!g_queue_remove(&priv->queue, task))
+    nsv_decoder_task_stop(task);
+
+  nsv_decoder_service_task_done(self, task, error_decoding_id);
+}
+
+static gint
+nsv_decoder_service_compare_priority(gconstpointer a, gconstpointer b,
+                                     gpointer user_data)
+{
+  /* higher priority first, first come first served otherwise */
+  return ((const NsvDecoderTask *)a)->priority >=
+      ((const NsvDecoderTask *)b)->priority ? -1 : 1;
+}
+
+static gint
+nsv_decoder_service_get_int_option(GHashTable *options, const char *name,
+                                   gint default_value)
+{
+  GValue *value = NULL;
+
+  if (options)
+    value = (GValue *)g_hash_table_lookup(options, name);
+
+  if (value && G_VALUE_HOLDS_INT(value))
+    return g_value_get_int(value);
+
+  return default_value;
+}
+
+static const gchar *
+nsv_decoder_service_get_string_option(GHashTable *options, const char *name)
+{
+  GValue *value = NULL;
+
+  if (options)
+    value = (GValue *)g_hash_table_lookup(options, name);
+
+  if (value && G_VALUE_HOLDS_STRING(value))
+    return g_value_get_string(value);
+
+  return NULL;
+}
+
+static gboolean
+nsv_decoder_service_get_boolean_option(GHashTable *options, const char *name)
+{
+  GValue *value = NULL;
+
+  if (options)
+    value = (GValue *)g_hash_table_lookup(options, name);
+
+  return value && G_VALUE_HOLDS_BOOLEAN(value) && g_value_get_boolean(value);
+}
+
+static gboolean
+nsv_decoder_service_supersede(NsvDecoderService *self, const gchar *category,
+                              const gchar *key)
+{
+  NsvDecoderServicePrivate *priv = self->priv;
+  GSList *superseded = NULL;
+  GHashTableIter iter;
+  gpointer job_key;
+  gpointer value;
+  GSList *l;
+
+  g_hash_table_iter_init(&iter, priv->jobs);
 
-      g_object_get(task,
-                   "source-file", &source_file,
-                   "target-file", &target_file,
-                   NULL);
+  while (g_hash_table_iter_next(&iter, &job_key, &value))
+  {
+    struct nsv_decode_job *job = (struct nsv_decode_job *)value;
+    GSList *link;
 
-      g_signal_emit(self, error_decoding_id, 0, task->category,
-                    source_file, target_file);
+    if (!g_strcmp0(job_key, key) ||
+        !(link = g_slist_find_custom(job->categories, category,
+                                     (GCompareFunc)g_strcmp0)))
+    {
+      continue;
+    }
 
-      g_free(source_file);
-      g_free(target_file);
-      g_object_unref(task);
+    /* still wanted by somebody else, just stop telling this category */
+    if (job->waiters || job->categories->next)
+    {
+      g_free(link->data);
+      job->categories = g_slist_delete_link(job->categories, link);
     }
     else
+      superseded = g_slist_prepend(superseded, job);
+  }
+
+  if (!superseded)
+    return FALSE;
+
+  for (l = superseded; l; l = l->next)
+  {
+    g_debug("Superseding a decode for %s", category);
+    nsv_decoder_service_cancel_job(self, (struct nsv_decode_job *)l->data);
+  }
+
+  g_slist_free(superseded);
+
+  return TRUE;
+}
+
+static void
+nsv_decoder_service_queue(NsvDecoderService *self, const gchar *category,
+                          const char *source_filename,
+                          const char *target_filename, GHashTable *options,
+                          struct nsv_decode_batch *batch)
+{
+  NsvDecoderServicePrivate *priv = self->priv;
+  gint priority = nsv_decoder_service_get_int_option(options, "priority", 0);
+  NsvDecoderTask *task;
+  struct nsv_decode_job *job;
+  gboolean superseded = FALSE;
+  gchar *key;
+
+  g_debug("Decoding (%s, priority %d): %s -> %s",
+        category, priority, source_filename, target_filename);
+
+  key = nsv_decoder_service_job_key(source_filename, target_filename);
+
+  /* whatever was decoded for this category before is not going to be heard */
+  if (!batch && nsv_decoder_service_get_boolean_option(options, "supersede"))
+    superseded = nsv_decoder_service_supersede(self, category, key);
+
+  job = (struct nsv_decode_job *)g_hash_table_lookup(priv->jobs, key);
+
+  if (job)
+  {
+    /* already queued or running, just wait for its result */
+    g_debug("Attaching (%s) to pending decode of %s", category,
+            source_filename);
+    g_free(key);
+    task = NULL;
+
+    if (priority > job->task->priority &&
+        g_queue_remove(&priv->queue, job->task))
     {
-      priv->current_task = task;
-      return;
+      task = job->task;
     }
   }
+  else
+  {
+    task =
+        (NsvDecoderTask *)nsv_decoder_task_new(source_filename,
+                                               target_filename);
+    task->category = g_strdup(category);
+
+    /* match the sink, tones are mono or stereo anyway */
+    g_object_set(task,
+                 "rate", CLAMP(nsv_decoder_service_get_int_option(
+                                 options, "rate", 48000), 8000, 192000),
+                 "channels", CLAMP(nsv_decoder_service_get_int_option(
+                                     options, "channels", 1), 1, 2),
+                 "format", nsv_decoder_service_get_string_option(options,
+                                                                 "format"),
+                 NULL);
 
-  if (!priv->exit_timeout_id)
+    job = g_slice_new0(struct nsv_decode_job);
+    job->task = task;
+    g_hash_table_insert(priv->jobs, key, job);
+  }
+
+  if (batch)
   {
-    priv->exit_timeout_id =
-        g_timeout_add_seconds(EXIT_TIMEOUT, exit_timeout_cb, NULL);
+    struct nsv_decode_waiter *waiter = g_slice_new(struct nsv_decode_waiter);
+
+    waiter->batch = batch;
+    waiter->category = g_strdup(category);
+    job->waiters = g_slist_append(job->waiters, waiter);
+    batch->pending++;
+  }
+  else if (!g_slist_find_custom(job->categories, category,
+                                (GCompareFunc)g_strcmp0))
+  {
+    job->categories = g_slist_append(job->categories, g_strdup(category));
+  }
+
+  if (task)
+  {
+    task->priority = priority;
+    g_queue_insert_sorted(&priv->queue, task,
+                          nsv_decoder_service_compare_priority, NULL);
+  }
+
+  if (task || superseded)
+    nsv_decoder_service_start_next_task(self);
+}
+
+static void
+nsv_decoder_service_cancel_exit(NsvDecoderService *self)
+{
+  NsvDecoderServicePrivate *priv = self->priv;
+
+  if (priv->exit_timeout_id)
+  {
+    g_source_remove(priv->exit_timeout_id);
+    priv->exit_timeout_id = 0;
+
+    /* woken up while idle, so more is likely to follow */
+    if (priv->tasks_done)
+    {
+      priv->idle_timeout = MIN(priv->idle_timeout * 2,
+                               MAX(priv->max_lifetime, priv->min_lifetime));
+    }
   }
 }
 
@@ -255,31 +1005,188 @@ nsv_decoder_service_decode(NsvDecoderService *self, const gchar *category,
                            const char *target_filename,
                            DBusGMethodInvocation *context)
 {
-  NsvDecoderTask *  task;
+  nsv_decoder_service_cancel_exit(self);
+  nsv_decoder_service_queue(self, category, source_filename, target_filename,
+                            NULL, NULL);
+  dbus_g_method_return(context, 0);
+}
+
+static void
+nsv_decoder_service_decode_with_options(NsvDecoderService *self,
+                                        const gchar *category,
+                                        const char *source_filename,
+                                        const char *target_filename,
+                                        GHashTable *options,
+                                        DBusGMethodInvocation *context)
+{
+  nsv_decoder_service_cancel_exit(self);
+  nsv_decoder_service_queue(self, category, source_filename, target_filename,
+                            options, NULL);
+  dbus_g_method_return(context, 0);
+}
+
+static void
+nsv_decoder_service_decode_many(NsvDecoderService *self, GPtrArray *requests,
+                                DBusGMethodInvocation *context)
+{
+  static guint last_batch_id = 0;
+  struct nsv_decode_batch *batch;
+  guint i;
+
+  nsv_decoder_service_cancel_exit(self);
+
+  batch = g_slice_new0(struct nsv_decode_batch);
+  batch->id = ++last_batch_id;
+  batch->decoded = (GPtrArray *)dbus_g_type_specialized_construct(
+        NSV_DECODER_TYPE_RESULTS);
+  batch->failed = (GPtrArray *)dbus_g_type_specialized_construct(
+        NSV_DECODER_TYPE_RESULTS);
+
+  /* hold the batch until every request is queued */
+  batch->pending = 1;
+
+  for (i = 0; i < requests->len; i++)
+  {
+    GValue value = {0, };
+    gchar *category = NULL;
+    gchar *source_filename = NULL;
+    gchar *target_filename = NULL;
+    GHashTable *options = NULL;
+
+    g_value_init(&value, NSV_DECODER_TYPE_REQUEST);
+    g_value_set_static_boxed(&value, g_ptr_array_index(requests, i));
+
+    if (dbus_g_type_struct_get(&value,
+                               0, &category,
+                               1, &source_filename,
+                               2, &target_filename,
+                               3, &options,
+                               G_MAXUINT))
+    {
+      nsv_decoder_service_queue(self, category, source_filename,
+                                target_filename, options, batch);
+    }
+
+    g_free(category);
+    g_free(source_filename);
+    g_free(target_filename);
+
+    if (options)
+      g_hash_table_unref(options);
+
+    g_value_unset(&value);
+  }
+
+  dbus_g_method_return(context, batch->id);
+  nsv_decoder_service_batch_release(self, batch);
+}
+
+static void
+nsv_decoder_service_promote(NsvDecoderService *self,
+                            const char *source_filename,
+                            DBusGMethodInvocation *context)
+{
   NsvDecoderServicePrivate *priv = self->priv;
+  GList *promoted = NULL;
+  GList *l;
 
-  g_debug("Decoding (%s): %s -> %s",
-        category, source_filename, target_filename);
+  for (l = priv->queue.head; l; l = l->next)
+  {
+    NsvDecoderTask *task = (NsvDecoderTask *)l->data;
+    gchar *source_file = NULL;
 
-  if (priv->exit_timeout_id)
+    g_object_get(task, "source-file", &source_file, NULL);
+
+    if (!g_strcmp0(source_file, source_filename))
+      promoted = g_list_prepend(promoted, task);
+
+    g_free(source_file);
+  }
+
+  /* somebody is waiting for it right now, it goes before everything else */
+  for (l = promoted; l; l = l->next)
   {
-    g_source_remove(priv->exit_timeout_id);
-    priv->exit_timeout_id = 0;
+    NsvDecoderTask *task = (NsvDecoderTask *)l->data;
+
+    g_debug("Promoting decode of %s", source_filename);
+    g_queue_remove(&priv->queue, task);
+    task->priority = PRIORITY_PROMOTED;
+    g_queue_push_head(&priv->queue, task);
   }
 
-  task =
-      (NsvDecoderTask *)nsv_decoder_task_new(source_filename, target_filename);
-  task->category = g_strdup(category);
-  g_queue_push_tail(&priv->queue, task);
-  nsv_decoder_service_start_next_task(self);
-  dbus_g_method_return(context, 0);
+  g_list_free(promoted);
+  dbus_g_method_return(context);
+}
+
+static void
+nsv_decoder_service_cancel(NsvDecoderService *self,
+                           const char *source_filename,
+                           DBusGMethodInvocation *context)
+{
+  NsvDecoderServicePrivate *priv = self->priv;
+  GSList *cancelled = NULL;
+  GHashTableIter iter;
+  gpointer value;
+  GSList *l;
+
+  g_hash_table_iter_init(&iter, priv->jobs);
+
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    struct nsv_decode_job *job = (struct nsv_decode_job *)value;
+    gchar *source_file = NULL;
+
+    g_object_get(job->task, "source-file", &source_file, NULL);
+
+    if (!g_strcmp0(source_file, source_filename))
+      cancelled = g_slist_prepend(cancelled, job);
+
+    g_free(source_file);
+  }
+
+  /* everybody waiting for it gets an error */
+  for (l = cancelled; l; l = l->next)
+  {
+    g_debug("Cancelling decode of %s", source_filename);
+    nsv_decoder_service_cancel_job(self, (struct nsv_decode_job *)l->data);
+  }
+
+  if (cancelled)
+    nsv_decoder_service_start_next_task(self);
+
+  g_slist_free(cancelled);
+  dbus_g_method_return(context);
+}
+
+static void
+nsv_decoder_service_get_stats(NsvDecoderService *self,
+                              DBusGMethodInvocation *context)
+{
+  GHashTable *stats = nsv_decoder_service_collect_stats(self);
+
+  dbus_g_method_return(context, stats);
+  g_hash_table_unref(stats);
 }
 
 int
 main(int argc, char **argv)
 {
   NsvDecoderService *decoder;
-  GMainLoop *loop;
+  GOptionContext *option_context;
+  GError *error = NULL;
+  gint max_tasks = 0;
+  gint min_lifetime = EXIT_TIMEOUT;
+  gint max_lifetime = MAX_LIFETIME;
+  GOptionEntry entries[] =
+  {
+    {"max-tasks", 'j', 0, G_OPTION_ARG_INT, &max_tasks,
+     "Number of files decoded in parallel", "N"},
+    {"min-lifetime", 't', 0, G_OPTION_ARG_INT, &min_lifetime,
+     "Seconds to stay around once idle", "SECONDS"},
+    {"max-lifetime", 'T', 0, G_OPTION_ARG_INT, &max_lifetime,
+     "Longest idle time while requests keep coming", "SECONDS"},
+    {NULL}
+  };
 
 #if !GLIB_CHECK_VERSION(2,32,0)
   g_thread_init(NULL);
@@ -287,11 +1194,32 @@ main(int argc, char **argv)
 #if !GLIB_CHECK_VERSION(2,35,0)
   g_type_init ();
 #endif
-  gst_init(&argc, &argv);
-  decoder = nsv_decoder_service_new();
-  loop = g_main_loop_new(NULL, FALSE);
-  g_main_loop_run(loop);
-  g_main_loop_unref(loop);
+  option_context = g_option_context_new(NULL);
+  g_option_context_add_main_entries(option_context, entries, NULL);
+  g_option_context_add_group(option_context, gst_init_get_option_group());
+
+  if (!g_option_context_parse(option_context, &argc, &argv, &error))
+  {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    g_option_context_free(option_context);
+    return 1;
+  }
+
+  g_option_context_free(option_context);
+
+  if (max_tasks <= 0)
+  {
+#if GLIB_CHECK_VERSION(2,36,0)
+    max_tasks = MIN(g_get_num_processors(), MAX_TASKS);
+#else
+    max_tasks = 1;
+#endif
+  }
+
+  decoder = nsv_decoder_service_new(max_tasks, MAX(min_lifetime, 1),
+                                    MAX(max_lifetime, 1));
+  nsv_decoder_service_run(decoder);
   g_object_unref(decoder);
 
   return 0;
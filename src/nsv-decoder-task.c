@@ -3,12 +3,24 @@
 #include <gst/gstelement.h>
 #include <gst/controller/controller.h>
 
+#include <stdio.h>
+#include <string.h>
+
 #include "nsv-decoder-task.h"
 
 #define NSV_DECODER_TASK_TYPE (nsv_decoder_task_get_type ())
 #define NSV_DECODER_TASK(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
             NSV_DECODER_TASK_TYPE, NsvDecoderTask))
 
+/* anything quieter than this is silence to the loop analysis, about -54 dB */
+#define SILENCE_LEVEL 64
+
+/* shorter loops are not worth the trouble */
+#define MIN_LOOP_MSECS 100
+
+/* enough for the chunks wavenc puts before the data */
+#define HEADER_SIZE 1024
+
 typedef struct _NsvDecoderTaskClass NsvDecoderTaskClass;
 
 enum
@@ -17,7 +29,10 @@ enum
   PROP_SOURCE_FILE,
   PROP_TARGET_FILE,
   PROP_CUT_OFF,
-  PROP_FADE_LENGTH
+  PROP_FADE_LENGTH,
+  PROP_RATE,
+  PROP_CHANNELS,
+  PROP_FORMAT
 };
 
 struct _NsvDecoderTaskClass {
@@ -30,13 +45,44 @@ struct _NsvDecoderTaskPrivate
   gchar *target_file;
   gint cut_off_time;
   gint fade_length_time;
+  gint rate;
+  gint channels;
+  gchar *format;
   gboolean decoding_completed;
-  guint data_so_far;
-  guint cut_off_time_mul_96;
-  gint emit_suceeded_timeout;
+  guint64 data_so_far;
+  guint64 cut_off_bytes;
+  GSource *emit_suceeded_source;
+  GMainContext *context;
   gboolean decoding_started;
+  NsvDecoderPipeline *pipeline;
+  gint64 start_time;
+  gint64 end_time;
+  GQuark error_domain;
+
+  /* loop analysis, in frames, written by the streaming thread */
+  guint64 frames;
+  gboolean have_sound;
+  guint64 loop_start;
+  guint64 loop_end;
+  gint16 last_sample;
+};
+
+/* the decoding graph, built once and then reused by one task after another */
+struct _NsvDecoderPipeline
+{
   GstElement *pipeline;
-  GstBus *gst_bus;
+  GstElement *filesrc;
+  GstElement *decodebin;
+  GstElement *encoder_bin;
+  GstElement *capsfilter;
+  GstElement *volume;
+  GstElement *compander;
+  const gchar *compander_name;
+  GstElement *wavenc;
+  GstElement *filesink;
+  GstControlSource *cs;
+  guint bus_watch_id;
+  NsvDecoderTask *task;
 };
 
 G_DEFINE_TYPE(NsvDecoderTask, nsv_decoder_task, G_TYPE_OBJECT);
@@ -79,6 +125,18 @@ nsv_decoder_task_set_property(GObject *object, guint prop_id,
     case PROP_FADE_LENGTH:
       priv->fade_length_time = g_value_get_int(value);
       break;
+    case PROP_RATE:
+      priv->rate = g_value_get_int(value);
+      break;
+    case PROP_CHANNELS:
+      priv->channels = g_value_get_int(value);
+      break;
+    case PROP_FORMAT:
+      if (priv->format)
+        g_free(priv->format);
+
+      priv->format = g_value_dup_string(value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -105,6 +163,15 @@ nsv_decoder_task_get_property(GObject *object, guint prop_id, GValue *value,
     case PROP_FADE_LENGTH:
       g_value_set_int(value, priv->fade_length_time);
       break;
+    case PROP_RATE:
+      g_value_set_int(value, priv->rate);
+      break;
+    case PROP_CHANNELS:
+      g_value_set_int(value, priv->channels);
+      break;
+    case PROP_FORMAT:
+      g_value_set_string(value, priv->format);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -115,12 +182,28 @@ static void
 _nsv_decoder_task_gst_cleanup(NsvDecoderTask *self)
 {
   NsvDecoderTaskPrivate *priv = self->priv;
+  GstBus *bus;
 
-  if (priv->pipeline)
+  if (!priv->pipeline)
+    return;
+
+  gst_element_set_state(priv->pipeline->pipeline, GST_STATE_NULL);
+
+  /* whatever is still queued belongs to this run, not to the next one */
+  bus = gst_pipeline_get_bus(GST_PIPELINE(priv->pipeline->pipeline));
+  gst_bus_set_flushing(bus, TRUE);
+  gst_bus_set_flushing(bus, FALSE);
+  gst_object_unref(bus);
+}
+
+static void
+_nsv_decoder_task_clear_source(GSource **source)
+{
+  if (*source)
   {
-    gst_element_set_state(priv->pipeline, GST_STATE_NULL);
-    gst_object_unref(priv->pipeline);
-    priv->pipeline = NULL;
+    g_source_destroy(*source);
+    g_source_unref(*source);
+    *source = NULL;
   }
 }
 
@@ -130,16 +213,16 @@ nsv_decoder_task_finalize(GObject *object)
   NsvDecoderTask *self = NSV_DECODER_TASK(object);
   NsvDecoderTaskPrivate *priv = self->priv;
 
-  if (priv->emit_suceeded_timeout)
-  {
-    g_source_remove(priv->emit_suceeded_timeout);
-    priv->emit_suceeded_timeout = 0;
-  }
+  _nsv_decoder_task_clear_source(&priv->emit_suceeded_source);
+
+  if (priv->context)
+    g_main_context_unref(priv->context);
 
   if (self->category)
     g_free(self->category);
 
-  _nsv_decoder_task_gst_cleanup(self);
+  if (priv->pipeline)
+    nsv_decoder_pipeline_free(nsv_decoder_task_take_pipeline(self));
 
   if (priv->target_file)
   {
@@ -153,6 +236,12 @@ nsv_decoder_task_finalize(GObject *object)
     priv->source_file = NULL;
   }
 
+  if (priv->format)
+  {
+    g_free(priv->format);
+    priv->format = NULL;
+  }
+
   g_free(priv);
 
   G_OBJECT_CLASS(parent_class)->finalize(object);
@@ -183,15 +272,33 @@ nsv_decoder_task_class_init(NsvDecoderTaskClass *klass)
         object_class, PROP_CUT_OFF,
         g_param_spec_int("cut-off",
                          NULL, "Cut off time in milliseconds",
-                         G_MININT, G_MAXINT, 60000,
+                         G_MININT, G_MAXINT, NSV_DECODER_TASK_CUT_OFF,
                          G_PARAM_CONSTRUCT | G_PARAM_READWRITE));
 
   g_object_class_install_property(
         object_class, PROP_FADE_LENGTH,
         g_param_spec_int("fade-length",
                          NULL, "How long to fade out in milliseconds",
-                         G_MININT, G_MAXINT, 5000,
+                         G_MININT, G_MAXINT, NSV_DECODER_TASK_FADE_LENGTH,
+                         G_PARAM_CONSTRUCT | G_PARAM_READWRITE));
+  g_object_class_install_property(
+        object_class, PROP_RATE,
+        g_param_spec_int("rate",
+                         NULL, "Sample rate of the decoded file",
+                         1, G_MAXINT, 48000,
                          G_PARAM_CONSTRUCT | G_PARAM_READWRITE));
+  g_object_class_install_property(
+        object_class, PROP_CHANNELS,
+        g_param_spec_int("channels",
+                         NULL, "Channels of the decoded file",
+                         1, G_MAXINT, 1,
+                         G_PARAM_CONSTRUCT | G_PARAM_READWRITE));
+  g_object_class_install_property(
+        object_class, PROP_FORMAT,
+        g_param_spec_string("format",
+                            NULL, "alaw or mulaw, 16 bit PCM otherwise",
+                            NULL,
+                            G_PARAM_READWRITE));
 
   succeeded_id = g_signal_new("succeeded",
                               G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
@@ -212,16 +319,148 @@ nsv_decoder_task_init(NsvDecoderTask *self)
   self->priv = g_new0(NsvDecoderTaskPrivate, 1);
 }
 
+static const gchar *
+_nsv_decoder_task_get_compander(NsvDecoderTask *self)
+{
+  const gchar *format = self->priv->format;
+
+  if (!g_strcmp0(format, "alaw"))
+    return "alawenc";
+
+  if (!g_strcmp0(format, "mulaw"))
+    return "mulawenc";
+
+  return NULL;
+}
+
+static gint
+_nsv_decoder_task_get_sample_size(NsvDecoderTask *self)
+{
+  /* companded samples are 8 bit, 16 bit PCM otherwise */
+  return _nsv_decoder_task_get_compander(self) ? 1 : 2;
+}
+
+static void
+_nsv_decoder_task_write_le32(guint8 *p, guint32 v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static guint32
+_nsv_decoder_task_read_le32(const guint8 *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32)p[3] << 24);
+}
+
+static void
+_nsv_decoder_task_write_loop(NsvDecoderTask *self)
+{
+  NsvDecoderTaskPrivate *priv = self->priv;
+  guint frame_size = priv->channels * _nsv_decoder_task_get_sample_size(self);
+  guint8 header[HEADER_SIZE];
+  guint8 smpl[68] = {0, };
+  guint32 data_pos = 0;
+  guint32 data_size = 0;
+  guint64 loop_end;
+  long file_size;
+  gsize length;
+  gsize pos = 12;
+  FILE *fp;
+
+  if (!priv->target_file || !(fp = fopen(priv->target_file, "r+b")))
+    return;
+
+  length = fread(header, 1, sizeof(header), fp);
+
+  while (pos + 8 <= length)
+  {
+    guint32 size = _nsv_decoder_task_read_le32(header + pos + 4);
+
+    if (!memcmp(header + pos, "data", 4))
+    {
+      data_pos = pos + 8;
+      data_size = size;
+      break;
+    }
+
+    pos += 8 + size + (size & 1);
+  }
+
+  if (!data_pos || fseek(fp, 0, SEEK_END) || (file_size = ftell(fp)) < 0)
+    goto out;
+
+  /* wavenc never got to fix the header if the cut-off stopped it */
+  if (!data_size || data_pos + (guint64)data_size > (guint64)file_size)
+  {
+    data_size = file_size - data_pos;
+    _nsv_decoder_task_write_le32(header, data_size);
+
+    if (fseek(fp, data_pos - 4, SEEK_SET) || fwrite(header, 4, 1, fp) != 1 ||
+        fseek(fp, 0, SEEK_END))
+    {
+      goto out;
+    }
+  }
+
+  /* up to the first clean crossing after the sound, or all of it */
+  loop_end = MIN(priv->loop_end ? priv->loop_end : priv->frames,
+                 data_size / frame_size);
+
+  /* silence has no loop, but the sizes above still had to be right */
+  if (!priv->have_sound ||
+      loop_end < priv->loop_start +
+      (guint64)priv->rate * MIN_LOOP_MSECS / 1000)
+  {
+    goto riff;
+  }
+
+  memcpy(smpl, "smpl", 4);
+  _nsv_decoder_task_write_le32(smpl + 4, sizeof(smpl) - 8);
+  _nsv_decoder_task_write_le32(smpl + 16, 1000000000 / priv->rate);
+  _nsv_decoder_task_write_le32(smpl + 20, 60);
+  _nsv_decoder_task_write_le32(smpl + 36, 1);
+
+  /* one forward loop, the end is inclusive, play count 0 is forever */
+  _nsv_decoder_task_write_le32(smpl + 52, priv->loop_start);
+  _nsv_decoder_task_write_le32(smpl + 56, loop_end - 1);
+
+  if ((file_size & 1) && fputc(0, fp) == EOF)
+    goto out;
+
+  if (fwrite(smpl, sizeof(smpl), 1, fp) != 1 || (file_size = ftell(fp)) < 0)
+    goto out;
+
+  g_debug("Loop of '%s' is %" G_GUINT64_FORMAT " - %" G_GUINT64_FORMAT,
+          priv->source_file, priv->loop_start, loop_end);
+
+riff:
+  _nsv_decoder_task_write_le32(header, file_size - 8);
+
+  if (!fseek(fp, 4, SEEK_SET))
+    fwrite(header, 4, 1, fp);
+
+out:
+  fclose(fp);
+}
+
 static gboolean
 _nsv_decoder_task_emit_suceeded_cb(gpointer user_data)
 {
   NsvDecoderTask *self = NSV_DECODER_TASK(user_data);
   NsvDecoderTaskPrivate *priv = self->priv;
 
+  g_source_unref(priv->emit_suceeded_source);
+  priv->emit_suceeded_source = NULL;
+
   if (priv->decoding_started)
   {
     priv->decoding_started = FALSE;
-    gst_element_set_state(priv->pipeline, GST_STATE_NULL);
+    priv->end_time = g_get_monotonic_time();
+    gst_element_set_state(priv->pipeline->pipeline, GST_STATE_NULL);
+    _nsv_decoder_task_write_loop(self);
     g_signal_emit(self, succeeded_id, 0);
   }
 
@@ -232,10 +471,16 @@ static GstPadProbeReturn
 _nsv_decoder_task_gst_buffer_probe_cb(GstPad *pad, GstPadProbeInfo *info,
                                       gpointer user_data)
 {
-  NsvDecoderTask *self = (NsvDecoderTask *)user_data;
-  NsvDecoderTaskPrivate *priv = self->priv;
+  NsvDecoderPipeline *pipeline = (NsvDecoderPipeline *)user_data;
+  NsvDecoderTask *self = pipeline->task;
+  NsvDecoderTaskPrivate *priv;
   GstBuffer *buffer;
 
+  if (!self)
+    return GST_PAD_PROBE_OK;
+
+  priv = self->priv;
+
   if (!(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) ||
       priv->decoding_completed)
   {
@@ -245,12 +490,72 @@ _nsv_decoder_task_gst_buffer_probe_cb(GstPad *pad, GstPadProbeInfo *info,
   buffer = gst_pad_probe_info_get_buffer(info);
   priv->data_so_far += gst_buffer_get_size(buffer);
 
-  if (priv->data_so_far < priv->cut_off_time_mul_96)
+  if (!priv->cut_off_bytes || priv->data_so_far < priv->cut_off_bytes)
     return GST_PAD_PROBE_OK;
 
   priv->decoding_completed = TRUE;
-  priv->emit_suceeded_timeout =
-      g_idle_add(_nsv_decoder_task_emit_suceeded_cb, self);
+
+  /* this runs in a streaming thread, get back to the one that started us */
+  priv->emit_suceeded_source = g_idle_source_new();
+  g_source_set_callback(priv->emit_suceeded_source,
+                        _nsv_decoder_task_emit_suceeded_cb, self, NULL);
+  g_source_attach(priv->emit_suceeded_source, priv->context);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+_nsv_decoder_task_gst_analyze_probe_cb(GstPad *pad, GstPadProbeInfo *info,
+                                       gpointer user_data)
+{
+  NsvDecoderPipeline *pipeline = (NsvDecoderPipeline *)user_data;
+  NsvDecoderTask *self = pipeline->task;
+  NsvDecoderTaskPrivate *priv;
+  GstMapInfo map;
+  const gint16 *samples;
+  gsize frames;
+  gsize i;
+  gint c;
+
+  if (!self || !(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER))
+    return GST_PAD_PROBE_OK;
+
+  priv = self->priv;
+
+  if (!gst_buffer_map(gst_pad_probe_info_get_buffer(info), &map, GST_MAP_READ))
+    return GST_PAD_PROBE_OK;
+
+  samples = (const gint16 *)map.data;
+  frames = map.size / (sizeof(gint16) * priv->channels);
+
+  for (i = 0; i < frames; i++, priv->frames++)
+  {
+    gint16 sample = samples[i * priv->channels];
+    gboolean clean = !sample || (priv->last_sample < 0 && sample >= 0);
+    gboolean sound = FALSE;
+
+    for (c = 0; c < priv->channels; c++)
+    {
+      if (ABS(samples[i * priv->channels + c]) > SILENCE_LEVEL)
+        sound = TRUE;
+    }
+
+    /* start at the last clean point before the sound, end at the first after */
+    if (clean && !priv->have_sound)
+      priv->loop_start = priv->frames;
+    else if (clean && !priv->loop_end)
+      priv->loop_end = priv->frames;
+
+    if (sound)
+    {
+      priv->have_sound = TRUE;
+      priv->loop_end = 0;
+    }
+
+    priv->last_sample = sample;
+  }
+
+  gst_buffer_unmap(gst_pad_probe_info_get_buffer(info), &map);
 
   return GST_PAD_PROBE_OK;
 }
@@ -282,18 +587,35 @@ static gboolean
 _nsv_decoder_task_gst_bus_watch_cb(GstBus *bus, GstMessage *message,
                                    gpointer user_data)
 {
-  NsvDecoderTask *self = (NsvDecoderTask *)user_data;
-  NsvDecoderTaskPrivate *priv = self->priv;
+  NsvDecoderPipeline *pipeline = (NsvDecoderPipeline *)user_data;
+  NsvDecoderTask *self = pipeline->task;
+  NsvDecoderTaskPrivate *priv;
+
+  /* nobody is decoding on this pipeline right now */
+  if (!self)
+    return TRUE;
+
+  priv = self->priv;
 
   switch (GST_MESSAGE(message)->type)
   {
     case GST_MESSAGE_ERROR:
     {
       GError *error = NULL;
+      gchar *debug = NULL;
 
       priv->decoding_started = FALSE;
-      gst_message_parse_error(message, &error, 0);
+      priv->end_time = g_get_monotonic_time();
+      gst_message_parse_error(message, &error, &debug);
+      priv->error_domain = error->domain;
+      g_warning("Decoding '%s' failed: %s (%s %d)", priv->source_file,
+                error->message, g_quark_to_string(error->domain), error->code);
+
+      if (debug)
+        g_debug("%s", debug);
+
       g_error_free(error);
+      g_free(debug);
 
       if (priv->target_file &&
           g_file_test(priv->target_file, G_FILE_TEST_EXISTS))
@@ -306,25 +628,25 @@ _nsv_decoder_task_gst_bus_watch_cb(GstBus *bus, GstMessage *message,
     }
     case GST_MESSAGE_SEGMENT_DONE:
     {
-      if (GST_ELEMENT(GST_MESSAGE(message)->src) != priv->pipeline)
+      if (GST_ELEMENT(GST_MESSAGE(message)->src) != pipeline->pipeline)
         break;
 
+      /* wavenc finalizes the header on EOS, the file is done after that */
       gst_element_send_event(GST_ELEMENT(GST_MESSAGE(message)->src),
                              gst_event_new_eos());
+      break;
     }
     case GST_MESSAGE_EOS:
     {
-      if (GST_ELEMENT(GST_MESSAGE(message)->src) == priv->pipeline &&
+      if (GST_ELEMENT(GST_MESSAGE(message)->src) == pipeline->pipeline &&
           priv->decoding_started)
       {
-        if (priv->emit_suceeded_timeout)
-        {
-          g_source_remove(priv->emit_suceeded_timeout);
-          priv->emit_suceeded_timeout = 0;
-        }
+        _nsv_decoder_task_clear_source(&priv->emit_suceeded_source);
 
         priv->decoding_started = FALSE;
         priv->decoding_completed = TRUE;
+        priv->end_time = g_get_monotonic_time();
+        _nsv_decoder_task_write_loop(self);
         g_signal_emit(self, succeeded_id, 0);
       }
 
@@ -336,7 +658,7 @@ _nsv_decoder_task_gst_bus_watch_cb(GstBus *bus, GstMessage *message,
       GstState newstate;
       GstState oldstate;
 
-      if (GST_ELEMENT(GST_MESSAGE(message)->src) != priv->pipeline)
+      if (GST_ELEMENT(GST_MESSAGE(message)->src) != pipeline->pipeline)
         break;
 
       gst_message_parse_state_changed(message, &oldstate, &newstate, &pending);
@@ -344,7 +666,7 @@ _nsv_decoder_task_gst_bus_watch_cb(GstBus *bus, GstMessage *message,
       if (oldstate == GST_STATE_READY && newstate == GST_STATE_PAUSED)
       {
         gst_element_send_event(
-              priv->pipeline,
+              pipeline->pipeline,
               gst_event_new_seek(1.0,
                                  GST_FORMAT_TIME,
                                  GST_SEEK_FLAG_SEGMENT | GST_SEEK_FLAG_FLUSH,
@@ -363,136 +685,236 @@ _nsv_decoder_task_gst_bus_watch_cb(GstBus *bus, GstMessage *message,
   return 1;
 }
 
-gboolean
-nsv_decoder_task_start(NsvDecoderTask *self)
+static GstElement *
+_nsv_decoder_pipeline_add(GstElement *bin, const gchar *factory_name)
 {
-  NsvDecoderTaskPrivate *priv = self->priv;
-  GstElement *filesrc;
-  GstElement *encoder_bin;
+  GstElement *element = gst_element_factory_make(factory_name, NULL);
+
+  if (element)
+    gst_bin_add(GST_BIN(bin), element);
+
+  return element;
+}
+
+NsvDecoderPipeline *
+nsv_decoder_pipeline_new()
+{
+  NsvDecoderPipeline *pipeline = g_slice_new0(NsvDecoderPipeline);
   GstElement *audioconvert;
   GstElement *audioresample;
-  GstElement *capsfilter;
-  GstElement *volume = NULL;
-  GstElement *wavenc = NULL;
-  GstElement *filesink;
   GstPad *sink_pad;
-  GstCaps *caps;
-  GstControlSource *cs;
-  GstTimedValueControlSource *tvcs;
   GstBus *bus;
-  GstElement *decodebin;
-  GstClockTime start;
-  GstClockTime end;
 
-  if (!(priv->pipeline = gst_pipeline_new("decoder-pipeline")) ||
-      !(filesrc = gst_element_factory_make("filesrc", NULL)) ||
-      !(decodebin = gst_element_factory_make("decodebin", NULL)))
+  if (!(pipeline->pipeline = gst_pipeline_new("decoder-pipeline")))
+    goto error;
+
+  if (!(pipeline->filesrc =
+        _nsv_decoder_pipeline_add(pipeline->pipeline, "filesrc")) ||
+      !(pipeline->decodebin =
+        _nsv_decoder_pipeline_add(pipeline->pipeline, "decodebin")) ||
+      !gst_element_link(pipeline->filesrc, pipeline->decodebin))
   {
-    if (priv->pipeline)
-    {
-      gst_object_unref(priv->pipeline);
-      priv->pipeline = NULL;
+    goto error;
+  }
 
-      if (filesrc)
-        gst_object_unref(filesrc);
-    }
+  if (!(pipeline->encoder_bin = gst_bin_new("encoder-bin")))
+    goto error;
+
+  gst_bin_add(GST_BIN(pipeline->pipeline), pipeline->encoder_bin);
+
+  if (!(audioconvert =
+        _nsv_decoder_pipeline_add(pipeline->encoder_bin, "audioconvert")) ||
+      !(audioresample =
+        _nsv_decoder_pipeline_add(pipeline->encoder_bin, "audioresample")) ||
+      !(pipeline->capsfilter =
+        _nsv_decoder_pipeline_add(pipeline->encoder_bin, "capsfilter")) ||
+      !(pipeline->volume =
+        _nsv_decoder_pipeline_add(pipeline->encoder_bin, "volume")) ||
+      !(pipeline->wavenc =
+        _nsv_decoder_pipeline_add(pipeline->encoder_bin, "wavenc")) ||
+      !(pipeline->filesink =
+        _nsv_decoder_pipeline_add(pipeline->encoder_bin, "filesink")))
+  {
+    goto error;
+  }
 
-    return FALSE;
+  if (!gst_element_link_many(audioconvert, audioresample, pipeline->capsfilter,
+                             pipeline->volume, pipeline->wavenc,
+                             pipeline->filesink,
+                             NULL))
+  {
+    goto error;
   }
 
-  gst_bin_add_many(GST_BIN(priv->pipeline), filesrc, decodebin, NULL);
+  sink_pad = gst_element_get_static_pad(audioconvert, "sink");
+  gst_element_add_pad(pipeline->encoder_bin,
+                      gst_ghost_pad_new("sink", sink_pad));
+  gst_object_unref(sink_pad);
+
+  g_signal_connect_data(G_OBJECT(pipeline->decodebin), "pad-added",
+                        (GCallback)_nsv_decoder_task_gst_new_decoded_pab_cb,
+                        pipeline->encoder_bin, NULL, 0);
+
+  /* fade points are set by every task, the binding stays */
+  pipeline->cs = gst_interpolation_control_source_new();
+  g_object_set(pipeline->cs, "mode", GST_INTERPOLATION_MODE_LINEAR, NULL);
+  gst_object_add_control_binding(
+        GST_OBJECT_CAST(pipeline->volume),
+        gst_direct_control_binding_new_absolute(
+          GST_OBJECT_CAST(pipeline->volume), "volume", pipeline->cs));
+
+  /* write through, so playback can follow the file while it grows */
+  g_object_set(G_OBJECT(pipeline->filesink), "buffer-mode", 2, NULL);
+
+  /* look at the samples before they are companded */
+  sink_pad = gst_element_get_static_pad(pipeline->volume, "src");
+  gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER,
+                    _nsv_decoder_task_gst_analyze_probe_cb, pipeline, NULL);
+  gst_object_unref(sink_pad);
 
-  if (!gst_element_link(filesrc, decodebin))
+  sink_pad = gst_element_get_static_pad(pipeline->filesink, "sink");
+
+  /* FIXME - shall we care for GST_PAD_PROBE_TYPE_BUFFER_LIST as well? */
+  gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER,
+                    _nsv_decoder_task_gst_buffer_probe_cb, pipeline, NULL);
+  gst_object_unref(sink_pad);
+
+  bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline->pipeline));
+  pipeline->bus_watch_id =
+      gst_bus_add_watch(bus, _nsv_decoder_task_gst_bus_watch_cb, pipeline);
+  gst_object_unref(bus);
+
+  return pipeline;
+
+error:
+  nsv_decoder_pipeline_free(pipeline);
+
+  return NULL;
+}
+
+void
+nsv_decoder_pipeline_free(NsvDecoderPipeline *pipeline)
+{
+  if (!pipeline)
+    return;
+
+  /* the watch lives in whatever context created the pipeline */
+  if (pipeline->bus_watch_id)
   {
-    g_object_unref(priv->pipeline);
-    priv->pipeline = NULL;
+    GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline->pipeline));
 
-    return FALSE;
+    gst_bus_remove_watch(bus);
+    gst_object_unref(bus);
   }
 
-  if (!(encoder_bin = gst_bin_new("encoder-bin")) ||
-      !(audioconvert = gst_element_factory_make("audioconvert", NULL)) ||
-      !(audioresample = gst_element_factory_make("audioresample", NULL)) ||
-      !(capsfilter = gst_element_factory_make("capsfilter", NULL)) ||
-      !(volume = gst_element_factory_make("volume", NULL)) ||
-      !(wavenc = gst_element_factory_make("wavenc", NULL)) ||
-      !(filesink = gst_element_factory_make("filesink", NULL)))
+  if (pipeline->pipeline)
   {
+    gst_element_set_state(pipeline->pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline->pipeline);
+  }
 
-    if (encoder_bin)
-    {
-      gst_object_unref(encoder_bin);
+  if (pipeline->cs)
+    gst_object_unref(pipeline->cs);
 
-      if (audioconvert)
-      {
-        gst_object_unref(audioconvert);
+  g_slice_free(NsvDecoderPipeline, pipeline);
+}
 
-        if (audioresample)
-        {
-          gst_object_unref(audioresample);
+static gboolean
+_nsv_decoder_pipeline_set_compander(NsvDecoderPipeline *pipeline,
+                                    const gchar *factory_name)
+{
+  if (!g_strcmp0(pipeline->compander_name, factory_name))
+    return TRUE;
 
-          if (capsfilter)
-          {
-            gst_object_unref(capsfilter);
+  /* the graph is in NULL state between tasks, relinking is safe */
+  if (pipeline->compander)
+  {
+    gst_bin_remove(GST_BIN(pipeline->encoder_bin), pipeline->compander);
+    pipeline->compander = NULL;
+  }
+  else
+    gst_element_unlink(pipeline->volume, pipeline->wavenc);
 
-            if (volume)
-            {
-              gst_object_unref(volume);
+  pipeline->compander_name = NULL;
 
-              if (wavenc)
-                gst_object_unref(wavenc);
-            }
-          }
-        }
-      }
-    }
+  if (factory_name)
+  {
+    pipeline->compander =
+        _nsv_decoder_pipeline_add(pipeline->encoder_bin, factory_name);
 
-    g_object_unref(priv->pipeline);
-    priv->pipeline = NULL;
+    if (pipeline->compander &&
+        gst_element_link_many(pipeline->volume, pipeline->compander,
+                              pipeline->wavenc, NULL))
+    {
+      pipeline->compander_name = factory_name;
+      return TRUE;
+    }
 
-    return FALSE;
+    if (pipeline->compander)
+    {
+      gst_bin_remove(GST_BIN(pipeline->encoder_bin), pipeline->compander);
+      pipeline->compander = NULL;
+    }
   }
 
-  gst_bin_add_many(GST_BIN(encoder_bin), audioconvert, audioresample,
-                   capsfilter, volume, wavenc, filesink, NULL);
+  /* a missing compander still leaves a usable graph behind */
+  return gst_element_link(pipeline->volume, pipeline->wavenc) &&
+      !factory_name;
+}
 
-  if (!gst_element_link_many(audioconvert, audioresample, capsfilter, volume,
-                             wavenc, filesink, NULL))
-  {
-    gst_object_unref(encoder_bin);
-    gst_object_unref(priv->pipeline);
-    priv->pipeline = NULL;
+gboolean
+nsv_decoder_task_start(NsvDecoderTask *self, NsvDecoderPipeline *pipeline)
+{
+  NsvDecoderTaskPrivate *priv = self->priv;
+  GstTimedValueControlSource *tvcs;
+  GstClockTime start;
+  GstClockTime end;
+  GstCaps *caps;
 
+  if (!pipeline || pipeline->task)
     return FALSE;
-  }
-
-  sink_pad = gst_element_get_static_pad(audioconvert, "sink");
-  gst_element_add_pad(encoder_bin, gst_ghost_pad_new("sink", sink_pad));
-  gst_object_unref(sink_pad);
 
-  gst_bin_add(GST_BIN(priv->pipeline), encoder_bin);
+  priv->pipeline = pipeline;
+  pipeline->task = self;
 
-  caps = gst_caps_new_simple("audio/x-raw",
-                             "rate", 24, 48000,
-                             "width", 24, 16,
-                             "depth", 24, 16,
-                             "channels", 24, 1,
-                             NULL);
+  if (!priv->context)
+    priv->context = g_main_context_ref_thread_default();
 
-  g_object_set(G_OBJECT(capsfilter), "caps", caps, NULL);
-  g_object_set(G_OBJECT(filesink), "location", priv->target_file, NULL);
-  g_object_set(G_OBJECT(filesrc), "location", priv->source_file, NULL);
+  priv->data_so_far = 0;
+  priv->decoding_completed = FALSE;
+  priv->start_time = g_get_monotonic_time();
+  priv->end_time = 0;
+  priv->error_domain = 0;
+  priv->frames = 0;
+  priv->have_sound = FALSE;
+  priv->loop_start = 0;
+  priv->loop_end = 0;
+  priv->last_sample = 0;
 
-  g_signal_connect_data(G_OBJECT(decodebin), "pad-added",
-                        (GCallback)_nsv_decoder_task_gst_new_decoded_pab_cb,
-                        encoder_bin, NULL, 0);
+  if (priv->cut_off_time > 0)
+  {
+    priv->cut_off_bytes = (guint64)priv->cut_off_time * priv->rate *
+        priv->channels * _nsv_decoder_task_get_sample_size(self) / 1000;
+  }
+  else
+    priv->cut_off_bytes = 0;
 
-  priv->gst_bus = gst_pipeline_get_bus(GST_PIPELINE(priv->pipeline));
+  /* the loop analysis relies on 16 bit samples */
+  caps = gst_caps_new_simple("audio/x-raw",
+                             "format", G_TYPE_STRING, "S16LE",
+                             "rate", G_TYPE_INT, priv->rate,
+                             "channels", G_TYPE_INT, priv->channels,
+                             NULL);
+  g_object_set(G_OBJECT(pipeline->capsfilter), "caps", caps, NULL);
+  gst_caps_unref(caps);
 
-  cs = gst_interpolation_control_source_new();
-  tvcs = (GstTimedValueControlSource *) cs;
+  g_object_set(G_OBJECT(pipeline->filesink), "location", priv->target_file,
+               NULL);
+  g_object_set(G_OBJECT(pipeline->filesrc), "location", priv->source_file,
+               NULL);
 
-  g_object_set (cs, "mode", GST_INTERPOLATION_MODE_LINEAR, NULL);
+  tvcs = (GstTimedValueControlSource *)pipeline->cs;
+  gst_timed_value_control_source_unset_all(tvcs);
 
   start = 1000000LL * (priv->cut_off_time - priv->fade_length_time);
   gst_timed_value_control_source_set(tvcs, start, 1.0f);
@@ -500,26 +922,11 @@ nsv_decoder_task_start(NsvDecoderTask *self)
   end = 1000000LL * priv->cut_off_time;
   gst_timed_value_control_source_set(tvcs, end, 0.0f);
 
-  gst_direct_control_binding_new(GST_OBJECT_CAST(volume), "volume", cs);
-
-  priv->cut_off_time_mul_96 = 96 * priv->cut_off_time;
-
-  if (priv->cut_off_time_mul_96 > 0)
-  {
-    sink_pad = gst_element_get_static_pad(filesink, "sink");
-
-    /* FIXME - shall we care for GST_PAD_PROBE_TYPE_BUFFER_LIST as well? */
-    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER,
-                      _nsv_decoder_task_gst_buffer_probe_cb, self, NULL);
-    gst_object_unref(sink_pad);
-  }
-
-  if (gst_element_set_state(priv->pipeline, GST_STATE_PLAYING))
+  if (_nsv_decoder_pipeline_set_compander(
+        pipeline, _nsv_decoder_task_get_compander(self)) &&
+      gst_element_set_state(pipeline->pipeline, GST_STATE_PLAYING))
   {
     priv->decoding_started = TRUE;
-    bus = gst_element_get_bus(priv->pipeline);
-    gst_bus_add_watch(bus, _nsv_decoder_task_gst_bus_watch_cb, self);
-    gst_object_unref(bus);
     return TRUE;
   }
 
@@ -528,6 +935,56 @@ nsv_decoder_task_start(NsvDecoderTask *self)
   return FALSE;
 }
 
+gint64
+nsv_decoder_task_get_wall_time(NsvDecoderTask *self)
+{
+  NsvDecoderTaskPrivate *priv = self->priv;
+
+  if (!priv->start_time)
+    return 0;
+
+  return (priv->end_time ? priv->end_time : g_get_monotonic_time()) -
+      priv->start_time;
+}
+
+gint64
+nsv_decoder_task_get_audio_time(NsvDecoderTask *self)
+{
+  NsvDecoderTaskPrivate *priv = self->priv;
+
+  /* the wav header is not worth subtracting */
+  return priv->data_so_far * G_USEC_PER_SEC /
+      (priv->rate * priv->channels * _nsv_decoder_task_get_sample_size(self));
+}
+
+guint64
+nsv_decoder_task_get_bytes_written(NsvDecoderTask *self)
+{
+  return self->priv->data_so_far;
+}
+
+GQuark
+nsv_decoder_task_get_error_domain(NsvDecoderTask *self)
+{
+  return self->priv->error_domain;
+}
+
+NsvDecoderPipeline *
+nsv_decoder_task_take_pipeline(NsvDecoderTask *self)
+{
+  NsvDecoderTaskPrivate *priv = self->priv;
+  NsvDecoderPipeline *pipeline = priv->pipeline;
+
+  if (!pipeline)
+    return NULL;
+
+  _nsv_decoder_task_gst_cleanup(self);
+  pipeline->task = NULL;
+  priv->pipeline = NULL;
+
+  return pipeline;
+}
+
 void
 nsv_decoder_task_stop(NsvDecoderTask *self)
 {
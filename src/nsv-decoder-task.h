@@ -3,16 +3,33 @@
 
 typedef struct _NsvDecoderTask NsvDecoderTask;
 typedef struct _NsvDecoderTaskPrivate NsvDecoderTaskPrivate;
+typedef struct _NsvDecoderPipeline NsvDecoderPipeline;
+
+/* defaults in milliseconds, the fade ends at the cut-off */
+#define NSV_DECODER_TASK_CUT_OFF 60000
+#define NSV_DECODER_TASK_FADE_LENGTH 5000
 
 struct _NsvDecoderTask
 {
   GObject parent_instance;
   gchar *category;
+  gint priority;
   NsvDecoderTaskPrivate *priv;
 };
 
 NsvDecoderTask *nsv_decoder_task_new(const gchar *source_file,
                                      const gchar *target_file);
-gboolean nsv_decoder_task_start(NsvDecoderTask *self);
+gboolean nsv_decoder_task_start(NsvDecoderTask *self,
+                                NsvDecoderPipeline *pipeline);
+NsvDecoderPipeline *nsv_decoder_task_take_pipeline(NsvDecoderTask *self);
 void nsv_decoder_task_stop(NsvDecoderTask *self);
+
+/* times are in usecs, a task still decoding reports what it has so far */
+gint64 nsv_decoder_task_get_wall_time(NsvDecoderTask *self);
+gint64 nsv_decoder_task_get_audio_time(NsvDecoderTask *self);
+guint64 nsv_decoder_task_get_bytes_written(NsvDecoderTask *self);
+GQuark nsv_decoder_task_get_error_domain(NsvDecoderTask *self);
+
+NsvDecoderPipeline *nsv_decoder_pipeline_new();
+void nsv_decoder_pipeline_free(NsvDecoderPipeline *pipeline);
 #endif // NSVDECODERTASK_H